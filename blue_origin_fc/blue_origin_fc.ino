@@ -13,12 +13,20 @@
 // 
 // Packets are ASCII string of 21 comma-separated values
 // size of packets <= 250 bytes (buffer is 256 bytes), 
-// individual fields will never exceed 20 bytes. Data
+// individual fields will never exceed 20 bytes. Packets have
+// no terminator; the first field is always the phase character
+// and is the only field that is not numeric. Data
 // stream starts approximately one minute after nano-labs are powered up
 // Data stream will close approximately five minutes after landing. 
 
 #include <SPI.h>  // required for SD library
 #include <SD.h>   // exposes functions for writing to/reading from SD card
+#include <avr/eeprom.h>   // reads the EEPROM checkpoint ring
+#include <util/atomic.h>  // guards multi-byte reads of ISR-owned data
+#include <avr/sleep.h>    // idles the core between tasks
+#include "pins.h"         // compile-time pin descriptors
+#include "events.h"       // log event catalogue
+#include "fields.h"       // Blue packet field positions
 
 // pin configuration macros
 #define CHIP_SELECT A0
@@ -38,12 +46,71 @@
 
 #define EXPERIMENT A5
 
+// pin descriptors for the pins above, with the level that turns
+// each device on. see pins.h
+// TODO: active state of motor?
+typedef Pin<PUMP_POWER, Polarity::ACTIVE_LOW> PumpPowerPin;
+typedef Pin<PUMP_1, Polarity::ACTIVE_HIGH> Pump1Pin;
+typedef Pin<PUMP_2, Polarity::ACTIVE_HIGH> Pump2Pin;
+typedef Pin<SOL_1, Polarity::ACTIVE_LOW> Sol1Pin;
+typedef Pin<SOL_2, Polarity::ACTIVE_LOW> Sol2Pin;
+typedef Pin<SOL_3, Polarity::ACTIVE_LOW> Sol3Pin;
+typedef Pin<MOTOR, Polarity::ACTIVE_LOW> MotorPin;
+typedef Pin<EXPERIMENT, Polarity::ACTIVE_LOW> ExperimentPin;
+
+typedef AnalogPin<TEMP_ANALOG_PIN> TempPin;
+typedef AnalogPin<CURR_ANALOG_PIN> CurrPin;
+typedef AnalogPin<VOLT_ANALOG_PIN> VoltPin;
+
+// actuators, as bits of an output configuration. a set bit
+// means on (pumps, motor, experiment) or open (valves)
+#define ACT_NONE        0x00
+#define ACT_PUMP_POWER  0x01
+#define ACT_PUMP_1      0x02
+#define ACT_PUMP_2      0x04
+#define ACT_SOL_1       0x08
+#define ACT_SOL_2       0x10
+#define ACT_SOL_3       0x20
+#define ACT_MOTOR       0x40
+#define ACT_EXPERIMENT  0x80
+
+#define ACT_PUMPS_M (ACT_PUMP_POWER | ACT_PUMP_1 | ACT_PUMP_2)
+#define ACT_CLEANING_M (ACT_PUMPS_M | ACT_SOL_1 | ACT_SOL_2 | ACT_SOL_3)
+
+// cleaning configurations: open the flow path of one pump and run it
+#define CLEAN_P1 (ACT_PUMP_POWER | ACT_PUMP_1 | ACT_SOL_1 | ACT_SOL_3)
+#define CLEAN_P2 (ACT_PUMP_POWER | ACT_PUMP_2 | ACT_SOL_2 | ACT_SOL_3)
+
 // Sensor gain constants
 #define CURR_GAIN_CONSTANT 68.4f
 
 // reference voltage
 #define V_REF 1.1f
 
+// the ADC interrupt scans CURR, VOLT and TEMP in turn, throwing
+// away the first conversion after each mux switch while the sample
+// and hold settles, then summing ADC_OVERSAMPLE conversions and
+// shifting out ADC_DECIMATE_SHIFT bits: 16x gives 12-bit readings
+#define ADC_CHANNELS 3
+#define ADC_OVERSAMPLE 16
+#define ADC_DECIMATE_SHIFT 2
+
+// positions in the scan, and in adc_latest
+#define ADC_CURR 0
+#define ADC_VOLT 1
+#define ADC_TEMP 2
+
+// internal 1.1V reference, nominally V_REF (and won't change much)
+#define ADC_ADMUX_REF (_BV(REFS1) | _BV(REFS0))
+
+// full scale oversampled ADC reading
+#define ADC_MAX (1023UL * ADC_OVERSAMPLE >> ADC_DECIMATE_SHIFT)
+
+// one pass over every channel, settling conversions included (us).
+// the scan starts with the sampler, so a pass has to be done before
+// the first sample is taken
+#define ADC_SCAN_TIME (ADC_CHANNELS * (ADC_OVERSAMPLE + 1) * 104UL)
+
 // how long (in ms) it takes to prime the experiment
 #define PRIME_TIME 3000
 
@@ -56,22 +123,82 @@
 // how long (in ms) it takes to finish stage 2
 #define STAGE_2_LENGTH 1000
 
-// how long to wait before taking another measurement (ms)
-#define LOG_TIME_CUTOFF 250
-
-// how long to listen on the serial line for new data (ms)
-#define SERIAL_TIMEOUT 20
+// plating telemetry rate (Hz), paced by Timer1: from 4 Hz, the
+// slowest Timer1 can go, to ~100 Hz, the most the sample fifo can
+// hold through a CARD_STALL_MAX stall. 1000 Hz would take a
+// 64-sample fifo (640 B) and an 8 MB data file
+#define SAMPLE_RATE_HZ 100
+#define SAMPLE_TIMER_PRESCALE 64
+#define SAMPLE_TIMER_TOP (F_CPU / SAMPLE_TIMER_PRESCALE / SAMPLE_RATE_HZ - 1)
+
+// ADAPTIVE_LOG stores only the samples needed to redraw every channel
+// within a tolerance, by swinging door compression: a sample is kept
+// once the straight line from the last kept one can no longer pass
+// within ADAPTIVE_DEV_* raw counts of every sample in between. flat
+// stretches shrink to one sample every ADAPTIVE_MAX_INTERVAL ms,
+// transients keep the full SAMPLE_RATE_HZ resolution
+// #define ADAPTIVE_LOG
+#define ADAPTIVE_DEV_VOLT 8
+#define ADAPTIVE_DEV_CURR 4
+#define ADAPTIVE_DEV_TEMP 16
+#define ADAPTIVE_MAX_INTERVAL 250
+
+// samples buffered between the timer interrupt and loop(), as few as
+// ride out a CARD_STALL_MAX stall on top of the samples task period
+// (must be a power of two)
+#define SAMPLE_FIFO_SIZE 8
+#define SAMPLE_FIFO_MASK (SAMPLE_FIFO_SIZE - 1)
+
+// longest the card can keep the samples task from running (ms): a
+// log and a data flush back to back on a card with 25 ms syncs, the
+// bench's slow model, and the sector reads they cost
+#define CARD_STALL_MAX 55
+
+// longest plating window the data file makes room for (s)
+#define PLATING_MAX_TIME 300UL
+
+// ACCEL_TRIGGER lets the acceleration fields gate plating inside the
+// phase bounds: from BS_COAST_START to BS_COAST_END, with a start
+// forced at BS_APOGEE if the gate has not opened by then. a close
+// pauses plating until the gate opens again, and only BS_COAST_END
+// ends it. the gate
+// watches |ax| + |ay| + |az| through a first order filter that moves
+// 1/2^ACCEL_FILTER_SHIFT of the way per packet. it opens once the
+// filter stays under ACCEL_QUIET for ACCEL_HOLD_TIME and closes once
+// it stays over ACCEL_LOUD as long (thousandths of m/s^2, ms)
+// #define ACCEL_TRIGGER
+#define ACCEL_FILTER_SHIFT 2
+#define ACCEL_SETTLE 8            // packets before the filter is trusted
+#define ACCEL_QUIET 150
+#define ACCEL_LOUD 300
+#define ACCEL_HOLD_TIME 500
+
+// how long the serial line must be idle before the last
+// packet of a burst is treated as complete (ms). packets sent
+// back to back are split on the next phase character instead
+#define FRAME_GAP_TIME 5
+
+// bytes are received into the core's Serial buffer, SERIAL_RX_BUFFER_SIZE
+// (64) bytes filled by its RX interrupt, and the serial task feeds them
+// straight to the tokenizer. most bytes read per pass of loop()
+#define RX_DRAIN_PER_LOOP 32
 
 // data packet information
 #define MAX_FRAME_SIZE 250
 #define MAX_FIELD_SIZE 20
-#define NUM_FIELDS 21
 #define DELIMITER ','
 
+// fields converted and kept. phase and time drive the lab; any
+// others chosen here are stored next to every sample in the data
+// file. the rest are only checked for length
+#define FIELD_SUBSCRIBED (FIELD_BIT(FIELD_PHASE) | FIELD_BIT(FIELD_TIME) \
+                          | FIELD_BIT(FIELD_ACC_X) | FIELD_BIT(FIELD_ACC_Y) | FIELD_BIT(FIELD_ACC_Z))
+
 // file names for logging, keeping track of state, etc.
-#define LOG_FILE_PATH "log.txt"
-#define STATE_FILE_PATH "state.txt"
-#define DATA_FILE_PATH "data.txt"
+#define STATE_FILE_PATH "state.bin"
+#define PROF_FILE_PATH "prof.txt"
+#define QUAL_FILE_PATH "qual.txt"
+#define QUAL_SCRATCH_PATH "qual.bin"
 
 // possible states for the blue rocket
 #define BS_NO_STATE '@'
@@ -106,503 +233,2771 @@
 // used to verify that a write was successful
 #define MAGIC_NUMBER 0x451b
 
+// the state file holds two checkpoint slots, one sector each.
+// writes alternate between them so a power loss mid-write
+// always leaves the other slot intact
+#define CHECKPOINT_SLOTS 2
+#define CHECKPOINT_SLOT_SIZE 512
+
+// opened for in-place writes (FILE_WRITE would append)
+#define BLOCK_FILE_MODE (O_READ | O_WRITE | O_CREAT)
+
+// the same checkpoints also go to a ring of EEPROM slots,
+// written round robin to spread wear across the cells
+#define EEPROM_CHECKPOINT_BASE 0
+#define EEPROM_CHECKPOINT_SLOTS 32
+#define EEPROM_SLOT_SIZE 32
+
+// the data file is a run of 512-byte blocks, each a header, as many
+// samples as fit and a CRC. samples are written into their block in
+// place, through the SD library's sector cache, and the header and
+// CRC follow at each commit
+#define DATA_BLOCK_SIZE 512
+#define DATA_MAGIC 0xda7a
+
+// layout of the samples in a data block. 1 holds 12-bit readings,
+// 2 adds the subscribed vehicle fields alongside each sample, 3 the
+// sample rate to the header, and 4 takes the CRC over the header and
+// the used samples only, so what a commit sealed stays valid on the
+// card while the next samples go in
+#define DATA_VERSION 4
+
+// bytes of stack file_fill() writes from
+#define FILL_CHUNK 32
+
+// bytes of stack the data block CRC is read back through
+#define CRC_CHUNK 32
+
+// blocks preallocated past the end of the data file on a cold start
+#define DATA_FILE_BLOCKS (PLATING_MAX_TIME * SAMPLE_RATE_HZ / SAMPLES_PER_BLOCK + 1)
+
+// every cold boot starts a new session: events go to L<nnnn>.BIN and
+// samples to D<nnnn>.BIN, and a hot restart carries on with the
+// session in its checkpoint. both files are preallocated as the
+// session starts, the log with erased records, so flight writes all
+// land in place. the files never grow, and a flush never has to
+// touch the FAT or the directory entry
+#define LOG_FILE_PREFIX 'L'
+#define DATA_FILE_PREFIX 'D'
+#define SESSION_MAX 9999
+#define LOG_FILE_BLOCKS 64        // ~2900 records
+#define LOG_ERASED 0xff           // code byte of a record not yet written
+
+// flush policy: log and data bytes still buffered in RAM are pushed
+// to the card once FLUSH_BYTES pile up, once the oldest of them is
+// FLUSH_INTERVAL ms old, or on a phase change. flushes wait for a gap
+// between packets, but never past FLUSH_DEADLINE ms
+#define FLUSH_BYTES 256
+#define FLUSH_INTERVAL 1000
+#define FLUSH_DEADLINE 2000
+
+// a flush or checkpoint can hold the card for as long as a whole
+// packet takes to come in, more than the receive buffer holds. so
+// they only start early in a gap, within CARD_WINDOW ms of the last
+// byte, or once the line has been quiet for CARD_QUIET ms. at 10 Hz
+// that leaves the card ~45 ms before the next packet
+#define CARD_WINDOW 40
+#define CARD_QUIET 200
+#define CARD_RETRY 5          // ms until a checkpoint held off tries again
+
+// log_msg() only queues an event in RAM. the log task writes them
+// out a few at a time between packets, and counts what a full
+// ring turns away
+#define LOG_RING_SIZE 8
+#define LOG_RING_MASK (LOG_RING_SIZE - 1)
+#define LOG_DRAIN_PER_PASS 2
+
+// a card is asked for CMD0 before SD.begin() goes near it, since
+// SD.begin() waits out a timeout of seconds on an empty slot. the
+// probe clocks at most 10 + SD_PROBE_TRIES * 15 bytes at
+// SD_PROBE_SPEED, ~2 ms. with no card the lab runs on its EEPROM
+// checkpoints, samples go unrecorded, and events wait in the log
+// ring until the sd task brings a card up
+#define SD_PROBE_TRIES 4
+#define SD_PROBE_WAIT 8           // bytes to wait for R1, the most a card may take
+#define SD_PROBE_SPEED 250000     // Hz, what a card must take before init
+#define SD_CMD0_R1_IDLE 0x01
+
+// a card that answers the probe but fails SD.begin() holds the loop
+// for its init timeout, ~2 s, on every try. after SD_TRIES such tries,
+// or sessions that wouldn't open, the sd task gives the card up
+#define SD_TRIES 3
+
+// scheduler task slots, run in this order when due together
+#define TASK_SERIAL 0       // drain the receive buffer into the parser
+#define TASK_LAB 1          // one-shot: next timed step of the lab
+#define TASK_SAMPLES 2      // move plating samples from the fifo to file
+#define TASK_LOG 3          // write queued log events out
+#define TASK_FLUSH 4        // apply the flush policy
+#define TASK_CHECKPOINT 5   // refresh the checkpoint with the newest Blue time
+#define TASK_SD 6           // bring up a card that was missing at boot
+#define TASK_MEM 7          // MEM_STATS builds: check the stack high-water mark
+#define NUM_TASKS 8
+
+// task periods (ms). the serial task keeps ahead of a 115200 baud
+// line (~12 bytes/ms) and the samples task empties the fifo as
+// each sample comes in
+#define SERIAL_TASK_PERIOD 1
+#define SAMPLES_TASK_PERIOD (1000UL / SAMPLE_RATE_HZ)
+#define LOG_TASK_PERIOD 10
+#define FLUSH_TASK_PERIOD 50
+#define CHECKPOINT_TASK_PERIOD 5000
+#define SD_TASK_PERIOD 5000
+#define MEM_TASK_PERIOD 1000
+
+// MEM_STATS builds paint the free RAM between heap and stack with
+// MEM_CANARY at boot, then look for the deepest the stack has reached.
+// MEM_PAINT_GUARD bytes under the stack pointer are left alone for
+// the painting's own frame. a new low is logged once the headroom
+// falls by MEM_REPORT_STEP bytes
+#define MEM_CANARY 0xc5
+#define MEM_PAINT_GUARD 16
+#define MEM_REPORT_STEP 16
+
+// PROFILE builds time every task run, checkpoint_sync() and every
+// scheduler pass that ran something, with micros(). passes are also
+// broken down by blue_state. min, max and count saturate at
+// PROF_SATURATE, so a max of 65535 is a run of 65.5 ms or more. the
+// tables take 212 bytes of SRAM, and run on the 328P as well as in
+// the simulator (sim/)
+#define PROF_RECORD NUM_TASKS
+#define PROF_PASS (NUM_TASKS + 1)
+#define PROF_SECTIONS (NUM_TASKS + 2)
+#define PROF_PHASES (BS_MISSION_END - BS_NO_STATE + 1)
+#define PROF_SATURATE 0xffff
+
+// SD_QUALIFY builds boot into a card qualification run instead of the
+// mission. every kind of card access the flight code makes is timed
+// QUAL_ROUNDS times on a scratch file, along with flushed sequential
+// writes of 32 to 512 bytes for sizing buffers. bucket k counts
+// operations under QUAL_BUCKET_BASE << 2k us, and the last reaches
+// past the few-hundred-ms stalls some cards take
+#define QUAL_ROUNDS 200
+#define QUAL_BUCKETS 8
+#define QUAL_BUCKET_BASE 64
+#define QUAL_OPEN 0           // SD.open, either mode
+#define QUAL_CLOSE 1
+#define QUAL_CHECKPOINT 2     // checkpoint_sync(): seek, write, flush
+#define QUAL_LOG 3            // one buffered log record
+#define QUAL_LOG_FLUSH 4      // flush after FLUSH_BYTES of records
+#define QUAL_SAMPLE 5         // data_block_put(): one sample into its block
+#define QUAL_SEAL 6           // data_block_seal() of a full block, flush
+#define QUAL_WRITE 7          // QUAL_WRITE + k: write 32 << k bytes, flush
+#define QUAL_WRITE_SIZES 5
+#define QUAL_OPS (QUAL_WRITE + QUAL_WRITE_SIZES)
+
 // typedefs
 
-// encapsulates environment data
+// one step of the cleaning sequence
+typedef struct clean_stage_st {
+  uint16_t lab_state_m;     // LS_CLEANING_*_M bit held during the stage
+  uint8_t outputs;          // ACT_CLEANING_M actuators on during the stage
+  uint16_t length;          // how long the stage runs (ms)
+} CleanStage;
+
+// encapsulates environment data, as raw ADC counts
 typedef struct env_data_st {
-  float volt_data;
-  float curr_data;
-  float temp_data;
+  uint16_t volt_raw;
+  uint16_t curr_raw;
+  uint16_t temp_raw;
 } EnvData;
 
+// time reported by New Shepard, in fixed point so that
+// epoch-sized values keep millisecond resolution
+typedef struct __attribute__((packed)) blue_time_st {
+  uint32_t sec;
+  uint16_t msec;
+} BlueTime;
+
 // encapsulates state information
 typedef struct state_st {
-  float last_blue_time;
+  BlueTime last_blue_time;
+  BlueTime phase_time;      // Blue time blue_state was entered
+  BlueTime step_time;       // Blue time the current timed lab step began
   uint16_t lab_state;
   char blue_state;
   char last_blue_state;
 } LabState;
 
+// on-card record of LabState. packed so the layout is the
+// same for every reader of the state file
+typedef struct __attribute__((packed)) checkpoint_st {
+  uint16_t magic;           // MAGIC_NUMBER
+  uint16_t seq;             // bumped on every write, newest slot wins
+  BlueTime last_blue_time;
+  BlueTime phase_time;
+  BlueTime step_time;
+  uint16_t lab_state;
+  char blue_state;
+  char last_blue_state;
+  uint16_t session;         // files the events and samples go to, 0 for none yet
+  uint16_t crc;             // CRC-16/CCITT over all fields above
+} Checkpoint;
+
+// the subscribed vehicle fields other than phase and time, in
+// field order. flags bit k is FIELD_WARN_LIFTOFF + k
+typedef struct __attribute__((packed)) vehicle_state_st {
+  int32_t value[field_count(FIELD_SUBSCRIBED & FIELD_VALUES_M)];   // thousandths
+  uint8_t flags;
+} VehicleState;
+
+// one sensor sample in the data file
+typedef struct __attribute__((packed)) sample_st {
+  uint32_t time;            // millis() when taken
+  EnvData env_data;
+  uint16_t lab_state;
+} Sample;
+
+// start of every data file block. samples are timed by millis(),
+// blue_time/blue_millis tie that clock to New Shepard's
+typedef struct __attribute__((packed)) data_header_st {
+  uint16_t magic;           // DATA_MAGIC
+  uint16_t seq;             // block number within the file
+  uint8_t count;            // samples used in this block
+  uint8_t version;          // DATA_VERSION
+  BlueTime blue_time;       // last Blue time when the block was started
+  uint32_t blue_millis;     // millis() when blue_time arrived
+  uint32_t fields;          // FIELD_SUBSCRIBED, which sets the VehicleState layout
+  uint16_t rate;            // SAMPLE_RATE_HZ the samples were taken at
+} DataHeader;
+
+#define SAMPLES_PER_BLOCK ((DATA_BLOCK_SIZE - sizeof(DataHeader) - sizeof(uint16_t)) \
+                           / (sizeof(Sample) + sizeof(VehicleState)))
+
+// one sector of the data file. vehicle[i] is the vehicle state
+// that was current when samples[i] was taken
+typedef struct __attribute__((packed)) data_block_st {
+  DataHeader header;
+  Sample samples[SAMPLES_PER_BLOCK];
+  VehicleState vehicle[SAMPLES_PER_BLOCK];
+  uint8_t pad[DATA_BLOCK_SIZE - sizeof(DataHeader)
+              - SAMPLES_PER_BLOCK * (sizeof(Sample) + sizeof(VehicleState)) - sizeof(uint16_t)];
+  uint16_t crc;             // CRC-16/CCITT over the header, then samples
+                            // and vehicle up to header.count
+} DataBlock;
+
+// swinging door state of ADAPTIVE_LOG builds. the door of each
+// channel is the steepest slope from the kept sample to a sample
+// since less dev, and the shallowest plus dev, as fractions over ms
+typedef struct door_st {
+  bool open;                // a sample has been kept since the sampler started
+  bool holding;             // held is newer than kept
+  Sample kept;              // last sample written out
+  Sample held;              // newest sample, written if the next one breaks the door
+  VehicleState held_vehicle;
+  int32_t up_n[3];          // by env_raw() channel
+  uint16_t up_d[3];         // 0 while the door is empty
+  int32_t lo_n[3];
+  uint16_t lo_d[3];
+  uint16_t count;           // samples kept this plating window
+} Door;
+
+// what the timer interrupt takes. the lab state is added as it is logged
+typedef struct raw_sample_st {
+  uint32_t time;            // millis() when taken
+  EnvData env_data;
+} RawSample;
+
+// samples taken by the timer interrupt, waiting to be logged
+typedef struct sample_fifo_st {
+  RawSample buf[SAMPLE_FIFO_SIZE];
+  volatile uint8_t head;    // next slot written by the timer
+  volatile uint8_t tail;    // next slot read by loop()
+  volatile uint16_t dropped; // samples lost to a full fifo
+} SampleFifo;
+
+// where the ADC interrupt is in its scan
+typedef struct adc_scan_st {
+  uint16_t sum;             // conversions summed for this reading
+  uint8_t count;            // conversions in sum
+  uint8_t channel;          // ADC_CURR, ADC_VOLT or ADC_TEMP
+  bool settling;            // next conversion is thrown away
+} AdcScan;
+
+// bytes written to a file but not yet flushed to the card
+typedef struct flush_state_st {
+  uint16_t pending;         // buffered bytes
+  unsigned long since;      // millis() of the oldest buffered byte
+} FlushState;
+
+// streaming tokenizer for Blue packets. holds only the field
+// being read and the values that get committed with the frame
+typedef struct frame_parser_st {
+  uint8_t field;                    // index of the field being read
+  uint8_t field_len;                // bytes read into the current field
+  uint8_t frame_len;                // bytes read into the current frame
+  bool rejected;                    // frame failed validation
+  int8_t frac_digits;               // digits after '.' in this field, -1 before it
+  bool negative;                    // this field started with '-'
+  int32_t value;                    // this field so far, if a subscribed number
+  char phase;                       // pending value of FIELD_PHASE
+  BlueTime time;                    // pending value of FIELD_TIME
+  VehicleState vehicle;             // pending values of the other subscribed fields
+} FrameParser;
+
+// one log_msg() or log_count() call, as queued and as written to
+// the log file. packed so decode_log.py sees the same layout
+typedef struct __attribute__((packed)) log_record_st {
+  uint8_t code;             // EventCode, see events.h
+  BlueTime time;
+  uint16_t lab_state;       // lab state when the event was logged
+  uint16_t count;           // log_count() argument, 0 otherwise
+} LogRecord;
+
+// log events on their way to the log file
+typedef struct log_ring_st {
+  LogRecord buf[LOG_RING_SIZE];
+  uint8_t head;             // next slot written by log_msg()
+  uint8_t tail;             // next slot written out by the log task
+  uint16_t dropped;         // events lost to a full ring
+} LogRing;
+
+// a job run by the scheduler. periodic tasks run every period ms,
+// one-shot tasks (period 0) run once at due and then disarm
+typedef struct task_st {
+  void (*run)();
+  unsigned long due;        // millis() of the next run
+  uint16_t period;          // ms between runs, 0 for one-shot
+  bool armed;               // due is live
+} Task;
+
+// the phase and step start times on this boot's millis()
+// clock. after a hot restart they are rebuilt from the Blue
+// times in the checkpoint
+typedef struct phase_clock_st {
+  unsigned long phase_millis;       // millis() at phase_time
+  unsigned long step_millis;        // millis() at step_time
+  bool synced;                      // lined up against a packet from this boot
+} PhaseClock;
+
+// the acceleration gate of ACCEL_TRIGGER builds
+typedef struct accel_gate_st {
+  int32_t level;            // filtered |ax| + |ay| + |az|
+  uint8_t packets;          // packets in the filter, up to ACCEL_SETTLE
+  bool quiet;               // the gate is open
+  bool crossing;            // level is on the other side of its threshold
+  unsigned long since;      // millis() when it crossed
+} AccelGate;
+
+// run times of one profiled section (us)
+typedef struct prof_section_st {
+  uint16_t min;
+  uint16_t max;
+  uint16_t count;
+  uint32_t total;           // of the runs counted
+} ProfSection;
+
+// run times of the scheduler passes in one blue_state (us)
+typedef struct prof_phase_st {
+  uint16_t max;
+  uint16_t count;
+  uint32_t total;
+} ProfPhase;
+
+// latencies of one kind of card operation (us). packed, as the
+// tables live in the qualification's sector buffer
+typedef struct __attribute__((packed)) qual_op_st {
+  uint32_t min;
+  uint32_t max;
+  uint32_t total;
+  uint32_t count;
+  uint16_t hist[QUAL_BUCKETS];     // saturates at 0xffff
+} QualOp;
+
 // end typedefs
 
+static_assert(sizeof(Checkpoint) <= EEPROM_SLOT_SIZE, "checkpoint must fit an EEPROM slot");
+static_assert(EEPROM_CHECKPOINT_BASE + EEPROM_CHECKPOINT_SLOTS * EEPROM_SLOT_SIZE <= E2END + 1,
+              "checkpoint ring must fit the EEPROM");
+static_assert(sizeof(DataBlock) == DATA_BLOCK_SIZE, "data block must be one sector");
+static_assert(DATA_BLOCK_SIZE % FILL_CHUNK == 0, "fill chunks must tile a block");
+static_assert((FIELD_SUBSCRIBED & FIELD_BIT(FIELD_PHASE)) && (FIELD_SUBSCRIBED & FIELD_BIT(FIELD_TIME)),
+              "the lab needs the phase and time fields");
+#ifdef ACCEL_TRIGGER
+static_assert((FIELD_SUBSCRIBED & FIELD_BIT(FIELD_ACC_X)) && (FIELD_SUBSCRIBED & FIELD_BIT(FIELD_ACC_Y))
+              && (FIELD_SUBSCRIBED & FIELD_BIT(FIELD_ACC_Z)), "ACCEL_TRIGGER needs the acceleration fields");
+#endif
+static_assert(SAMPLES_TASK_PERIOD > 0, "sample rate too high to drain the fifo on time");
+static_assert((CARD_STALL_MAX * SAMPLE_RATE_HZ + 999) / 1000 + 1 <= SAMPLE_FIFO_SIZE - 1,
+              "sample rate too high for the fifo to ride out a card stall");
+static_assert(SAMPLE_TIMER_TOP <= 0xffff, "sample rate too low for Timer1");
+static_assert(ADC_SCAN_TIME < 1000000UL / SAMPLE_RATE_HZ,
+              "sample rate too high for an ADC scan to finish before the first sample");
+
 
 // global variables
 
+// timestamp used before New Shepard has told us the time
+const BlueTime no_blue_time = {0, 0};
+
 // contains information about the flight state of MiniMEE
 // and New Shepard
 LabState state;
 
+// true once SD.begin() has succeeded and log_file is open
+bool sd_ready = false;
+
+// SD.begin() has succeeded. it can't be called again, so a session
+// that failed to open is retried on the card as it is
+bool sd_up = false;
+
+// tries at a card that answered the probe and still didn't come up
+uint8_t sd_fails = 0;
+
+// number of this boot's session files, 0 until one is picked
+uint16_t session = 0;
+
 // acts as record of events during flight
 File log_file;
 
 // stores environmental/experimental data
 File data_file;
 
+// header of the data file block being filled, and where the block
+// is in the file. its samples are already in the card's sector cache
+DataHeader data_header;
+uint16_t data_block_index = 0;
+
+// millis() when last_blue_time arrived
+unsigned long last_blue_millis = 0;
+
+// last_blue_millis as of the newest checkpoint
+unsigned long checkpoint_blue_millis = 0;
+
+// when the current phase and timed step began, in millis()
+PhaseClock phase_clock;
+
+// holds the checkpoint slots, kept open for in-place writes
+File state_file;
+
+// sequence number of the last checkpoint written or restored
+uint16_t checkpoint_seq = 0;
+
+// the newest checkpoint. EE_READY_vect programs it into EEPROM, and
+// the checkpoint task copies it to the state file in a card window
+Checkpoint checkpoint_cp;
+uint16_t eeprom_write_addr;
+volatile uint8_t eeprom_write_left = 0;  // bytes not yet programmed
+bool checkpoint_pending = false;          // not yet in the state file
+
+// millis() when read_serial_input() last found bytes waiting
+unsigned long last_rx_time = 0;
+
+// drains that found the receive buffer full, each losing a byte or more
+uint16_t rx_full = 0;
+
+// frame currently being tokenized
+FrameParser parser;
+
+// vehicle fields from the newest packet and the one before it, and
+// millis() when the newest arrived, so that each sample is stored
+// with the state that was current when it was taken
+VehicleState vehicle;
+VehicleState vehicle_prev;
+unsigned long vehicle_millis;
+
+#ifdef ACCEL_TRIGGER
+AccelGate accel_gate;
+#endif
+
+#ifdef ADAPTIVE_LOG
+Door door;
+
+// tolerance of each channel, by env_raw() index
+const uint8_t door_dev[3] = { ADAPTIVE_DEV_VOLT, ADAPTIVE_DEV_CURR, ADAPTIVE_DEV_TEMP };
+#endif
+
+// ADC mux channel for each position in the scan
+const uint8_t adc_channels[ADC_CHANNELS] = {
+  CurrPin::channel,
+  VoltPin::channel,
+  TempPin::channel
+};
+
+// newest oversampled reading of each channel, kept by ADC_vect
+AdcScan adc_scan;
+volatile uint16_t adc_latest[ADC_CHANNELS];
+
+// the cleaning sequence, run in order after landing
+const CleanStage clean_stages[] PROGMEM = {
+  { LS_CLEANING_1_M, CLEAN_P2, STAGE_1_LENGTH },
+  { LS_CLEANING_2_M, CLEAN_P1, STAGE_2_LENGTH },
+  { LS_CLEANING_3_M, CLEAN_P2, STAGE_1_LENGTH },
+  { LS_CLEANING_4_M, CLEAN_P1, STAGE_2_LENGTH },
+  { LS_CLEANING_5_M, CLEAN_P2, STAGE_1_LENGTH },
+};
+#define CLEAN_STAGES static_cast<uint8_t>(sizeof(clean_stages) / sizeof(clean_stages[0]))
+
+// output configuration last committed to the actuator pins
+uint8_t actuators = ACT_NONE;
+
+// plating samples on their way from the timer to the data file
+SampleFifo sample_fifo;
+
+// what is still buffered for log_file and data_file
+FlushState log_flush;
+FlushState data_flush;
+
+// log events not yet written to log_file
+LogRing log_ring;
+
+// the next flush ignores the policy's limits
+bool flush_forced = false;
+
+// scheduler slots, indexed by TASK_*
+Task tasks[NUM_TASKS];
+
 // end global variables
 
 
 // debug macros
 
 // #define DEBUG
+// #define MEM_STATS
+// #define PROFILE
+// #define SD_QUALIFY
 
 #ifdef DEBUG
-  #define LOG_MSG(x) Serial.print(x)
-  #define LOG_MSG_LN(x) Serial.println(x)
+  #define LOG_OUT Serial
 #else
-  #define LOG_MSG(x) log_file.print(x)
-  #define LOG_MSG_LN(x) log_file.println(x)
+  #define LOG_OUT log_file
+#endif
+
+#define LOG_MSG(x) flush_note(log_flush, LOG_OUT.print(x))
+#define LOG_MSG_LN(x) flush_note(log_flush, LOG_OUT.println(x))
+
+// event text for DEBUG builds, which log to the console as text
+#ifdef DEBUG
+  #define EVENT_TEXT(name, text, counted) const char name##_text[] PROGMEM = text;
+  EVENT_LIST(EVENT_TEXT)
+
+  #define EVENT_TEXT_PTR(name, text, counted) name##_text,
+  const char *const event_text[NUM_EVENTS] PROGMEM = { EVENT_LIST(EVENT_TEXT_PTR) };
+
+  #define EVENT_COUNTED(name, text, counted) counted,
+  const uint8_t event_counted[NUM_EVENTS] PROGMEM = { EVENT_LIST(EVENT_COUNTED) };
+#endif
+
+#ifdef MEM_STATS
+  // ends of static data and of the heap, from the avr-libc linker script
+  extern uint8_t __heap_start;
+  extern uint8_t *__brkval;
+
+  // lowest stack headroom logged so far
+  uint16_t mem_low_headroom = 0xffff;
+#endif
+
+#ifdef PROFILE
+  ProfSection prof_sections[PROF_SECTIONS];
+  ProfPhase prof_phases[PROF_PHASES];
+
+  // names of the sections, by TASK_* then PROF_RECORD and PROF_PASS
+  const char prof_names[PROF_SECTIONS][11] PROGMEM = {
+    "serial", "lab", "samples", "log", "flush", "checkpoint", "sd", "mem", "record", "pass"
+  };
+
+  #define PROF_BEGIN(v) unsigned long v = micros()
+  #define PROF_END(section, v) prof_add(section, micros() - v)
+#else
+  #define PROF_BEGIN(v)
+  #define PROF_END(section, v)
+#endif
+
+#ifdef SD_QUALIFY
+  // the sector the run writes out. it flies no mission, so there is
+  // room for it, and the tables live in it
+  uint8_t qual_buf[DATA_BLOCK_SIZE];
+  QualOp *const qual_ops = reinterpret_cast<QualOp *>(qual_buf);
+  static_assert(sizeof(QualOp) * QUAL_OPS <= sizeof(qual_buf), "qualification tables must fit the sector buffer");
+
+  // names of the operations, by QUAL_*
+  const char qual_names[QUAL_OPS][12] PROGMEM = {
+    "open", "close", "checkpoint", "log", "log_flush", "sample", "seal",
+    "write_32", "write_64", "write_128", "write_256", "write_512"
+  };
 #endif
 
 // end debug macros
 
 // initialize serial interface
 void serial_init() {
+  parser_reset();
   Serial.begin(115200, SERIAL_8N1);
   while (!Serial);
-  Serial.setTimeout(SERIAL_TIMEOUT);  // ensures that we capture every packet
-  log_msg(0.0f, "Serial");
+  log_msg(no_blue_time, EV_SERIAL);
 }
 
-// initialize SD card interface
-void sd_init() {
+// sends CMD0 to the card slot a few times, at the speed and after
+// the idle clocks a card needs before init. true if a card answered
+// idle. bounded at a few ms, present card or not
+bool sd_probe() {
+  const uint8_t cmd0[] = { 0x40, 0, 0, 0, 0, 0x95 };  // GO_IDLE_STATE and its CRC
+
+  pinMode(CHIP_SELECT, OUTPUT);
+  digitalWrite(CHIP_SELECT, HIGH);
+  SPI.begin();
+  SPI.beginTransaction(SPISettings(SD_PROBE_SPEED, MSBFIRST, SPI_MODE0));
+
+  // at least 74 clocks deselected finish the card's power up
+  for (uint8_t i = 0; i < 10; i++) {
+    SPI.transfer(0xff);
+  }
+
+  bool idle = false;
+  for (uint8_t tries = 0; tries < SD_PROBE_TRIES && !idle; tries++) {
+    digitalWrite(CHIP_SELECT, LOW);
+    for (uint8_t i = 0; i < sizeof(cmd0); i++) {
+      SPI.transfer(cmd0[i]);
+    }
+    uint8_t r1 = 0xff;
+    for (uint8_t i = 0; i < SD_PROBE_WAIT && r1 == 0xff; i++) {
+      r1 = SPI.transfer(0xff);
+    }
+    digitalWrite(CHIP_SELECT, HIGH);
+    SPI.transfer(0xff);   // the card lets go of MISO a byte later
+    idle = r1 == SD_CMD0_R1_IDLE;
+  }
+  SPI.endTransaction();
+  return idle;
+}
+
+// initialize SD card interface, if there is a card to answer the
+// probe. session_open() then opens the files
+bool sd_init() {
+  if (sd_up) {
+    return true;
+  }
+  if (!sd_probe()) {
+    return false;
+  }
   if (!SD.begin(CHIP_SELECT)) {
-    log_msg(0.0f, "!SD");  
-  } else {
-    log_file = SD.open(LOG_FILE_PATH, FILE_WRITE);
-    log_msg(0.0f, "SD");
+    sd_fails++;
+    return false;
   }
+  sd_up = true;
+  log_msg(state.last_blue_time, EV_SD);
+  return true;
 }
 
-// initialize pin 
-void pin_init() {
-  // nominally, this is 1.1V (and won't change much)
-  analogReference(INTERNAL);
+// writes the 8.3 name of session n's file starting with prefix
+// into path, which holds 13 characters
+void session_path(char *path, const char prefix, uint16_t n) {
+  path[0] = prefix;
+  for (uint8_t i = 4; i > 0; i--) {
+    path[i] = '0' + n % 10;
+    n /= 10;
+  }
+  strcpy(path + 5, ".BIN");
+}
 
-  // initialize pump pins
-  pinMode(PUMP_POWER, OUTPUT);
-  pinMode(PUMP_1, OUTPUT);
-  pinMode(PUMP_2, OUTPUT);
+// binary searches the card for the first session number without a
+// log file. sessions are only ever added in order, so this takes
+// 14 SD.exists() calls. once they run out the last one is reused
+uint16_t session_next() {
+  char path[13];
+  uint16_t lo = 1;
+  uint16_t hi = SESSION_MAX + 1;
+  while (lo < hi) {
+    uint16_t mid = lo + (hi - lo) / 2;
+    session_path(path, LOG_FILE_PREFIX, mid);
+    if (SD.exists(path)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo > SESSION_MAX ? SESSION_MAX : lo;
+}
 
-  // initialize experiment pin
-  pinMode(EXPERIMENT, OUTPUT);
+// writes fill over f from pos up to end, FILL_CHUNK bytes at a time.
+// the SD library gathers them into whole sectors in its cache
+void file_fill(File &f, uint32_t pos, const uint32_t end, const uint8_t fill) {
+  uint8_t buf[FILL_CHUNK];
+  memset(buf, fill, sizeof(buf));
+  f.seek(pos);
+  for (; pos < end; pos += sizeof(buf)) {
+    f.write(buf, sizeof(buf));
+  }
+}
 
-  // initialize motor pin
-  pinMode(MOTOR, OUTPUT);
+// pads f with fill up to blocks whole blocks
+void file_prealloc(File &f, const uint16_t blocks, const uint8_t fill) {
+  file_fill(f, f.size() - f.size() % DATA_BLOCK_SIZE, static_cast<uint32_t>(blocks) * DATA_BLOCK_SIZE, fill);
+  f.flush();
+}
 
-  // initialize solenoid pins
-  pinMode(SOL_1, OUTPUT);
-  pinMode(SOL_2, OUTPUT);
-  pinMode(SOL_3, OUTPUT);
+// true if log record i has been written
+bool log_record_used(const uint32_t i) {
+  log_file.seek(i * sizeof(LogRecord));
+  int code = log_file.read();
+  return code >= 0 && code != LOG_ERASED;
+}
 
-  // pins for sensor reading
-  pinMode(TEMP_ANALOG_PIN, INPUT);
-  pinMode(CURR_ANALOG_PIN, INPUT);
-  pinMode(VOLT_ANALOG_PIN, INPUT);
-
-  // valves are active low
-  // pumps are active high
-  // pump power active low
-  // motor active low
-  // experiment is active low
-  // TODO: active state of motor?
-  digitalWrite(PUMP_POWER, HIGH);
-  digitalWrite(PUMP_1, LOW);
-  digitalWrite(PUMP_2, LOW);
-  digitalWrite(SOL_1, HIGH);
-  digitalWrite(SOL_2, HIGH);
-  digitalWrite(SOL_3, HIGH);
-  digitalWrite(MOTOR, HIGH);
-  digitalWrite(EXPERIMENT, HIGH);
-
-  log_msg(state.last_blue_time, "pins");
-}
-
-// reads state information from state file
-// and attempts to re-initialize the lab to that state. 
-void restore_state() {
-  #ifndef DEBUG
-  File state_file = SD.open(STATE_FILE_PATH, FILE_READ);
-  if (state_file.peek() > -1) {
-    // read state data
-    state.lab_state = state_file.read();
-    state_file.read();  // consume delimiter
-    state.blue_state = state_file.read();
-  } else {
-    LOG_MSG_LN("!state_data");
+// binary searches the log file for its first erased record
+uint32_t log_find_end() {
+  uint32_t lo = 0;
+  uint32_t hi = log_file.size() / sizeof(LogRecord);
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    if (log_record_used(mid)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
   }
-  state_file.close();
-  SD.remove(STATE_FILE_PATH);
-  #endif
+  return lo;
 }
 
-// writes current lab state to state file
-void record_state() {
-  #ifndef DEBUG
-  if (SD.exists(STATE_FILE_PATH)) {
-    SD.remove(STATE_FILE_PATH);
-  }
-  // record:
-  //  magic number (first 2 bytes)
-  //  last blue time (precisely 4 bytes (float))
-  //  last blue state (1 byte (ASCII char)
-  //  last lab state (1 byte (between 1 and 11)
-
-  File state_file = SD.open(STATE_FILE_PATH, FILE_WRITE);
-
-  // begin writing real state data
-  state_file.print(state.lab_state);
-  state_file.print(DELIMITER);
-  state_file.print(state.blue_state);
-  state_file.println(DELIMITER);
-  state_file.close();
-  #endif
+// opens the current session's log, picking a new session if there
+// is none, and positions it after the last record written. prealloc
+// lays out both files first, which takes seconds on a slow card
+bool session_open(const bool prealloc) {
+  if (session == 0) {
+    session = session_next();
+  }
+  char path[13];
+  session_path(path, LOG_FILE_PREFIX, session);
+  log_file = SD.open(path, BLOCK_FILE_MODE);
+  if (!log_file) {
+    sd_fails++;
+    return false;
+  }
+  if (prealloc) {
+    file_prealloc(log_file, LOG_FILE_BLOCKS, LOG_ERASED);
+    data_log_prealloc();
+  }
+  log_file.seek(log_find_end() * sizeof(LogRecord));
+
+  sd_ready = true;
+
+  // a card that went in late finds the ring full of what happened
+  // without it. writing that out first leaves room for the session
+  log_drain(LOG_RING_SIZE);
+  log_count(state.last_blue_time, EV_SESSION, session);
+  return true;
 }
 
-// attempts to read a new serial packet from the 
-// featherframe serial interface. 
-void read_serial_input() {
-  int fields_read = 0;
-  char *fields[NUM_FIELDS];
-  char buf[MAX_FRAME_SIZE + 1];
-  size_t bytes = Serial.readBytes(buf, MAX_FRAME_SIZE);
-  buf[bytes] = '\0';
-
-  // process the frame
-  char * ptr;
-  ptr = strtok(buf, ",");
-  int i = 0;
-  while (ptr != NULL) {
-    fields[i] = ptr;
-    ptr = strtok(NULL, ",");
-    i++;
-  }
-
-  // extract what we care about
-  state.blue_state = fields[0][0];
-  state.last_blue_time = atof(fields[1]);
-  // TODO: expand this list?
-}
-
-// poll sensors for current environmental data. Stores results
-// in EnvData struct env_data
-void read_sensors(EnvData &env_data) {
-  env_data.curr_data = static_cast<float>(analogRead(CURR_ANALOG_PIN) * (V_REF / 1023.0) / CURR_GAIN_CONSTANT);
-  env_data.volt_data = V_REF - static_cast<float>(analogRead(VOLT_ANALOG_PIN) * (V_REF / 1023.0));
-  env_data.temp_data = static_cast<float>(analogRead(TEMP_ANALOG_PIN) * (V_REF / 1023.0) * 100);
-}
-
-// write polled sensor data to file
-void log_sensor_data(const EnvData &env_data, File data_file) {
-  // convert sensor values to strings
-  char s_volt[10];
-  char s_curr[10];
-  char s_temp[10];
-  dtostrf(env_data.volt_data, 5, 3, s_volt);
-  dtostrf(env_data.curr_data, 5, 3, s_curr);
-  dtostrf(env_data.temp_data, 5, 3, s_temp);
-
-  // write sensor data to data file
-  #ifdef DEBUG
-    LOG_MSG(state.last_blue_time);
-    LOG_MSG(DELIMITER);
-    LOG_MSG(s_volt);
-    LOG_MSG(DELIMITER);
-    LOG_MSG(s_curr);
-    LOG_MSG(DELIMITER);
-    LOG_MSG_LN(s_temp);
-  #else
-    data_file.print(state.last_blue_time);
-    data_file.print(DELIMITER);
-    data_file.print(s_volt);
-    data_file.print(DELIMITER);
-    data_file.print(s_curr);
-    data_file.print(DELIMITER);
-    data_file.println(s_temp);
-  #endif    // DEBUG
+// gates the clocks of the peripherals the lab never uses. the
+// UART, SPI, ADC and timers 0 and 1 stay powered
+void power_init() {
+  PRR |= _BV(PRTWI) | _BV(PRTIM2);
+  ACSR |= _BV(ACD);   // analog comparator off
 }
 
-// write a message to the log file at time t
-void log_msg(const float t, const char* msg) {
-  LOG_MSG(t);
-  LOG_MSG(": ");
-  LOG_MSG_LN(msg);
+// power the ADC up without converting. it stays enabled for the
+// whole mission so the 1.1V reference on AREF is settled by the time
+// a plating window starts the scan
+void adc_init() {
+  // digital input buffers on the sensor pins only add noise
+  DIDR0 = CurrPin::didr | VoltPin::didr | TempPin::didr;
+  ADMUX = ADC_ADMUX_REF | adc_channels[ADC_CURR];
+
+  // 16MHz / 128 = 125kHz ADC clock, ~104us per conversion
+  ADCSRA = _BV(ADEN) | _BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0);
 }
 
-// check if the bits specified by mask are flipped
-bool check_lab_state(const uint16_t &mask) {
-  return (state.lab_state & mask);
+// start the free-running scan. only the sampler needs it, and
+// outside plating its ~9600 conversions a second would wake the
+// idle sleep for nothing
+void adc_start() {
+  adc_scan.sum = 0;
+  adc_scan.count = 0;
+  adc_scan.channel = ADC_CURR;
+  adc_scan.settling = true;
+  ADMUX = ADC_ADMUX_REF | adc_channels[ADC_CURR];
+
+  // writing ADIF clears a result left over from the last window
+  ADCSRA |= _BV(ADIF) | _BV(ADIE) | _BV(ADSC);
 }
 
-// starts cleaning step specified by i
-void start_cleaning(uint8_t i) {
-  if (i == 1) {
-    digitalWrite(SOL_2, LOW);
-    digitalWrite(SOL_3, LOW);
-                   
-    // run p2
-    digitalWrite(PUMP_POWER, LOW);
-    digitalWrite(PUMP_2, HIGH);
-    log_msg(state.last_blue_time, "clean1");
-  } else if (i == 2) {
-    digitalWrite(SOL_1, LOW);
-    digitalWrite(SOL_3, LOW);
-  
-    // run p1
-    digitalWrite(PUMP_POWER, LOW);
-    digitalWrite(PUMP_1, HIGH);
-    log_msg(state.last_blue_time, "clean2");
-  } else {
-    log_msg(state.last_blue_time, "invalid cleaning step");
-  }
-}
-
-// stops cleaning step specified by i
-void stop_cleaning(uint8_t i) {
-  if (i == 1) {
-    digitalWrite(SOL_2, HIGH);
-    digitalWrite(SOL_3, HIGH);
-                   
-    // run p2
-    digitalWrite(PUMP_POWER, HIGH);
-    digitalWrite(PUMP_2, LOW);
-    log_msg(state.last_blue_time, "!clean1");
-  } else if (i == 2) {
-    digitalWrite(SOL_1, HIGH);
-    digitalWrite(SOL_3, HIGH);
-  
-    // run p1
-    digitalWrite(PUMP_POWER, HIGH);
-    digitalWrite(PUMP_1, LOW);
-    log_msg(state.last_blue_time, "!clean2");
+// stop the scan. a conversion in flight finishes without an interrupt
+void adc_stop() {
+  ADCSRA &= ~_BV(ADIE);
+}
+
+// each conversion lands here and the next one is started right away
+ISR(ADC_vect) {
+  uint16_t sample = ADC;
+  if (adc_scan.settling) {
+    adc_scan.settling = false;
   } else {
-    log_msg(state.last_blue_time, "invalid cleaning step");
+    adc_scan.sum += sample;
+    if (++adc_scan.count == ADC_OVERSAMPLE) {
+      adc_latest[adc_scan.channel] = adc_scan.sum >> ADC_DECIMATE_SHIFT;
+      adc_scan.sum = 0;
+      adc_scan.count = 0;
+
+      // the mux switch applies to the conversion started below
+      adc_scan.channel = (adc_scan.channel + 1) % ADC_CHANNELS;
+      ADMUX = ADC_ADMUX_REF | adc_channels[adc_scan.channel];
+      adc_scan.settling = true;
+    }
   }
+  ADCSRA |= _BV(ADSC);
 }
 
-// determines if we can start priming. returns true if so, false otherwise
-bool sep_cmd_wait() {
-  static unsigned long sep_cmd_time = millis();
-  return (millis() - sep_cmd_time >= PRIME_WAIT_TIME);
+// pin levels on port p for the output configuration on. polarity
+// comes from the pin descriptors and folds away for constant
+// configurations
+constexpr uint8_t act_port_image(const Port p, const uint8_t on) {
+  return PumpPowerPin::image(p, on & ACT_PUMP_POWER)
+       | Pump1Pin::image(p, on & ACT_PUMP_1)
+       | Pump2Pin::image(p, on & ACT_PUMP_2)
+       | Sol1Pin::image(p, on & ACT_SOL_1)
+       | Sol2Pin::image(p, on & ACT_SOL_2)
+       | Sol3Pin::image(p, on & ACT_SOL_3)
+       | MotorPin::image(p, on & ACT_MOTOR)
+       | ExperimentPin::image(p, on & ACT_EXPERIMENT);
 }
 
-// configures and initializes serial, sd,
-// pump, solenoid, experiment interfaces
-void setup() {
-  // need serial line configured first if debugging
-  #ifdef DEBUG
-    serial_init();
-    sd_init();
-  #else
-    sd_init();
-    serial_init();
-  #endif
+// bits of port p that drive actuators
+constexpr uint8_t act_port_mask(const Port p) {
+  return PumpPowerPin::bits(p) | Pump1Pin::bits(p) | Pump2Pin::bits(p)
+       | Sol1Pin::bits(p) | Sol2Pin::bits(p) | Sol3Pin::bits(p)
+       | MotorPin::bits(p) | ExperimentPin::bits(p);
+}
 
-  // determine if we need to read last state
-  if (SD.exists(STATE_FILE_PATH)) {
-    restore_state();
-    log_msg(state.last_blue_time, "hot");
-  } else {
-    // initialize default state
-    state.last_blue_time = 0.0f;
-    state.lab_state  = LS_NO_STATE;
-    state.blue_state = BS_NO_STATE;
-    state.last_blue_state = BS_NO_STATE;
-    log_msg(state.last_blue_time, "cold");
+// latches the configuration on onto every actuator port
+inline void act_write(const uint8_t on) {
+  PORTB = (PORTB & ~act_port_mask(Port::B)) | act_port_image(Port::B, on);
+  PORTC = (PORTC & ~act_port_mask(Port::C)) | act_port_image(Port::C, on);
+  PORTD = (PORTD & ~act_port_mask(Port::D)) | act_port_image(Port::D, on);
+}
+
+// drives every actuator to the configuration on in three steps: the
+// pumps that stop go off, then every valve and other output takes its
+// new level, then the pumps that start come on. a pump that runs
+// through a stage swap keeps running while the valves move, and no
+// pump ever runs against a path that is closing or not yet open
+void actuators_commit(const uint8_t on) {
+  uint8_t pumps = actuators & on & ACT_PUMPS_M;   // on before and after
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    act_write((actuators & ~ACT_PUMPS_M) | pumps);
+    act_write((on & ~ACT_PUMPS_M) | pumps);
+    act_write(on);
   }
-  
-  // configure pins
-  pin_init();
+  actuators = on;
 }
 
-// state machine predicated on state of blue rocket
-void loop() {
-  if (Serial.available() > 0) {
-    read_serial_input();
+// turn the actuators in mask on, leaving the rest as they are
+void actuators_on(const uint8_t mask) {
+  actuators_commit(actuators | mask);
+}
+
+// turn the actuators in mask off, leaving the rest as they are
+void actuators_off(const uint8_t mask) {
+  actuators_commit(actuators & ~mask);
+}
+
+// initialize pin 
+void pin_init() {
+  // latch everything off before the pins become outputs,
+  // so the active low actuators never see a low glitch
+  actuators_commit(ACT_NONE);
+  DDRB |= act_port_mask(Port::B);
+  DDRC |= act_port_mask(Port::C);
+  DDRD |= act_port_mask(Port::D);
+
+  // pins for sensor reading
+  TempPin::input();
+  CurrPin::input();
+  VoltPin::input();
+  adc_init();
+
+  log_msg(state.last_blue_time, EV_PINS);
+}
+
+// output configuration the lab should have in its current state,
+// used to pick up where we left off after a hot restart
+uint8_t lab_state_actuators() {
+  uint8_t on = ACT_NONE;
+  if (check_lab_state(LS_PRIMING_M)) {
+    on |= ACT_MOTOR;
+  }
+  if (check_lab_state(LS_PLATING_M)) {
+    on |= ACT_EXPERIMENT;
   }
+  uint8_t i = cleaning_stage();
+  if (i < CLEAN_STAGES) {
+    on |= pgm_read_byte(&clean_stages[i].outputs);
+  }
+  return on;
+}
 
-  // check to see if blue's state updated when we read
-  if (state.blue_state != state.last_blue_state) {
-    record_state();
+// folds len bytes at data into the CRC-16/CCITT (poly 0x1021) crc
+uint16_t crc16_update(uint16_t crc, const void *data, size_t len) {
+  const uint8_t *p = static_cast<const uint8_t *>(data);
+  while (len--) {
+    crc ^= static_cast<uint16_t>(*p++) << 8;
+    for (uint8_t i = 0; i < 8; i++) {
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+    }
   }
+  return crc;
+}
 
-  switch(state.blue_state) {
+// CRC-16/CCITT (poly 0x1021, init 0xffff) of len bytes at data
+uint16_t crc16(const void *data, size_t len) {
+  return crc16_update(0xffff, data, len);
+}
 
-    case BS_SEP_COMMANDED:    // CC is free
-    {
-      // have we already primed?
-      if (!check_lab_state(LS_PRIMED_M)) {
-        
-        // wait until things have settled down
-        if (!sep_cmd_wait())
-          break;
-          
-        // 
-        static unsigned long prime_start_time;
-        if (!check_lab_state(LS_PRIMING_M)) {
-          // start priming
-          state.lab_state &= ~LS_IDLING_M;
-          state.lab_state |= LS_PRIMING_M;
-          record_state();
+// true if cp was written completely
+bool checkpoint_valid(const Checkpoint &cp) {
+  return cp.magic == MAGIC_NUMBER
+      && cp.crc == crc16(&cp, sizeof(cp) - sizeof(cp.crc));
+}
 
-          digitalWrite(MOTOR, LOW);
+// opens the state file, growing it to hold every checkpoint slot
+// if it is new. this is the only time the file changes size
+bool state_file_open() {
+  state_file = SD.open(STATE_FILE_PATH, BLOCK_FILE_MODE);
+  if (!state_file) {
+    return false;
+  }
 
-          log_msg(state.last_blue_time, "priming");
+  uint32_t size = state_file.size();
+  if (size < CHECKPOINT_SLOTS * CHECKPOINT_SLOT_SIZE) {
+    state_file.seek(size);
+    for (; size < CHECKPOINT_SLOTS * CHECKPOINT_SLOT_SIZE; size++) {
+      state_file.write(static_cast<uint8_t>(0));
+    }
+    state_file.flush();
+  }
+  return true;
+}
 
-          prime_start_time = millis();
-        } else if (millis() - prime_start_time >= PRIME_TIME) {
-          // stop priming
-          state.lab_state &= ~LS_PRIMING_M;
-          state.lab_state |= (LS_PRIMED_M | LS_IDLING_M);
-          record_state();
+// fills cp with the current lab state
+void make_checkpoint(Checkpoint &cp) {
+  cp.magic = MAGIC_NUMBER;
+  cp.seq = checkpoint_seq;
+  cp.last_blue_time = state.last_blue_time;
+  cp.phase_time = state.phase_time;
+  cp.step_time = state.step_time;
+  cp.lab_state = state.lab_state;
+  cp.blue_state = state.blue_state;
+  cp.last_blue_state = state.last_blue_state;
+  cp.session = session;
+  cp.crc = crc16(&cp, sizeof(cp) - sizeof(cp.crc));
+}
 
-          digitalWrite(MOTOR, HIGH);
+// re-initializes the lab to the state held in cp. until the next
+// packet the checkpoint's Blue time stands in for the time now, so
+// waits in progress are measured from the checkpoint at the latest
+void apply_checkpoint(const Checkpoint &cp) {
+  checkpoint_seq = cp.seq;
+  state.last_blue_time = cp.last_blue_time;
+  state.phase_time = cp.phase_time;
+  state.step_time = cp.step_time;
+  state.lab_state = cp.lab_state;
+  state.blue_state = cp.blue_state;
+  state.last_blue_state = cp.last_blue_state;
+  session = cp.session;
+
+  last_blue_millis = millis();
+  phase_clock_sync();
+  phase_clock.synced = false;
+}
 
-          log_msg(state.last_blue_time, "!priming");
-        }
-      }
-    }
-    break;
+// EEPROM address of checkpoint slot i
+inline uint16_t eeprom_slot_addr(uint8_t i) {
+  return EEPROM_CHECKPOINT_BASE + static_cast<uint16_t>(i) * EEPROM_SLOT_SIZE;
+}
 
-    case BS_APOGEE:
-    {
-      // do nothing, we want to flow into coast start
-      // since we should still be plating at this point
+// programs the pending checkpoint one byte per interrupt,
+// so an EEPROM write never stalls loop()
+ISR(EE_READY_vect) {
+  if (eeprom_write_left == 0) {
+    EECR &= ~_BV(EERIE);
+    return;
+  }
+  uint8_t i = sizeof(Checkpoint) - eeprom_write_left--;
+  EEAR = eeprom_write_addr + i;
+  EEDR = reinterpret_cast<const uint8_t *>(&checkpoint_cp)[i];
+  EECR |= _BV(EEMPE);
+  EECR |= _BV(EEPE);
+}
+
+// hot restart fast path: restores the newest valid checkpoint in
+// the EEPROM ring. needs nothing else to be up, so setup() runs it
+// first. returns false if the ring holds no valid checkpoint
+bool eeprom_restore_state() {
+  #ifndef DEBUG
+  // find the newest slot from the headers alone, so
+  // only the slots we might use get checked in full
+  uint8_t newest = 0;
+  uint16_t newest_seq = 0;
+  bool found = false;
+  for (uint8_t i = 0; i < EEPROM_CHECKPOINT_SLOTS; i++) {
+    uint16_t header[2];   // magic, seq
+    eeprom_read_block(header, reinterpret_cast<const void *>(eeprom_slot_addr(i)), sizeof(header));
+    if (header[0] != MAGIC_NUMBER) {
+      continue;
     }
-    
-    case BS_COAST_START:
-    {
-      // if primed, start experiment
-      // take a measurement (every .25 seconds)
-      if (check_lab_state(LS_PRIMED_M)) {
-        static unsigned long logging_time;
-        if (!check_lab_state(LS_PLATING_M)) {
-          state.lab_state &= ~LS_IDLING_M;
-          state.lab_state |= LS_PLATING_M;
-          digitalWrite(EXPERIMENT, LOW);
-          
-          data_file = SD.open(DATA_FILE_PATH, FILE_WRITE);
-  
-          logging_time = millis();
-        } else if (millis() - logging_time >= LOG_TIME_CUTOFF) {
-          // take a measurement
-          EnvData env_data;
-          read_sensors(env_data);
-          log_sensor_data(env_data, data_file);
-          logging_time = millis();
-        }
-      } else {
-        // TODO: modularize priming
-      }
+    // sequence numbers wrap, so compare by difference
+    if (!found || static_cast<int16_t>(header[1] - newest_seq) > 0) {
+      newest = i;
+      newest_seq = header[1];
+      found = true;
     }
-    break;
+  }
+  if (!found) {
+    return false;
+  }
 
-    case BS_COAST_END:
-    {
-      if (!(state.lab_state & LS_PLATED_M)) {
-        state.lab_state |= LS_IDLING_M | LS_PLATED_M;
-        state.lab_state &= ~LS_PLATING_M;
-        record_state();
-        
-        log_msg(state.last_blue_time, "!plating");
-        log_msg(state.last_blue_time, "plating->idle");
-        
-        // clean up
-        data_file.close();
-        digitalWrite(EXPERIMENT, HIGH);
-      }
+  // a reset mid-write leaves the newest slot torn; walk
+  // back through older slots until one checks out
+  for (uint8_t n = 0; n < EEPROM_CHECKPOINT_SLOTS; n++) {
+    uint8_t i = (newest + EEPROM_CHECKPOINT_SLOTS - n) % EEPROM_CHECKPOINT_SLOTS;
+    Checkpoint cp;
+    eeprom_read_block(&cp, reinterpret_cast<const void *>(eeprom_slot_addr(i)), sizeof(cp));
+    if (checkpoint_valid(cp)) {
+      apply_checkpoint(cp);
+      return true;
     }
-    break;
+  }
+  #endif
+  return false;
+}
 
-    case BS_LANDING:
-    {
-      // flow into safing state since we do the same thing
-    }
+// queues cp to be programmed into its EEPROM slot in the background.
+// a write still in flight is abandoned; its slot fails the CRC check
+void eeprom_record_state(const Checkpoint &cp) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    checkpoint_cp = cp;
+    eeprom_write_addr = eeprom_slot_addr(cp.seq % EEPROM_CHECKPOINT_SLOTS);
+    eeprom_write_left = sizeof(cp);
+    EECR |= _BV(EERIE);
+  }
+}
 
-    case BS_SAFING:   
-    {
-      if (!check_lab_state(LS_CLEANED_M)) {
-        static unsigned long clean_time;
-        if (check_lab_state(LS_CLEANING_1_M)) {
-          // transition to 2
-          if (millis() - clean_time >= STAGE_1_LENGTH) {
-            state.lab_state &= ~LS_CLEANING_1_M;
-            state.lab_state |= LS_CLEANING_2_M;
-            stop_cleaning(1);
-            start_cleaning(2);
-            clean_time = millis();
-          }
-          // cleaning_step_1();
-        } else if (check_lab_state(LS_CLEANING_2_M)) {
-          // transition to 3
-          if (millis() - clean_time >= STAGE_2_LENGTH) {
-            state.lab_state &= ~LS_CLEANING_2_M;
-            state.lab_state |= LS_CLEANING_3_M;
-            stop_cleaning(2);
-            start_cleaning(1);
-            clean_time = millis();
-          }
-        } else if (check_lab_state(LS_CLEANING_3_M)) {
-          // transition to 4
-          if (millis() - clean_time >= STAGE_1_LENGTH) {
-            state.lab_state &= ~LS_CLEANING_3_M;
-            state.lab_state |= LS_CLEANING_4_M;
-            stop_cleaning(1);
-            start_cleaning(2);
-            clean_time = millis();
-          }
-        } else if (check_lab_state(LS_CLEANING_4_M)) {
-          // transition to 5
-          if (millis() - clean_time >= STAGE_2_LENGTH) {
-            state.lab_state &= ~LS_CLEANING_4_M;
-            state.lab_state |= LS_CLEANING_5_M;
-            stop_cleaning(2);
-            start_cleaning(1);
-            clean_time = millis();
-          }
-        } else if (check_lab_state(LS_CLEANING_5_M)) {
-          // end
-          if (millis() - clean_time >= STAGE_1_LENGTH) {
-            state.lab_state &= ~LS_CLEANING_5_M;
-            state.lab_state |= LS_CLEANED_M | LS_IDLING_M;
-            stop_cleaning(1);
-            record_state();
-
-            // clean up whole lab
-            log_msg(state.last_blue_time, "!cleaning");
-            
-            log_msg(state.last_blue_time, "clean->idle");
-  
-            // close streams
-            log_file.close();
-            SD.remove(STATE_FILE_PATH);
-          }
-        } else {
-          // we haven't done any cleaning yet
-          state.lab_state &= ~LS_IDLING_M;
-          state.lab_state |= LS_CLEANING_1_M;
-          start_cleaning(1);
-          clean_time = millis();
-        }
-      }
-    }
-    break;
+// invalidates every EEPROM checkpoint so the next power up is cold.
+// blocks until the EEPROM is done, only used once the mission is over
+void eeprom_clear_state() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    eeprom_write_left = 0;
+    EECR &= ~_BV(EERIE);
+  }
+  for (uint8_t i = 0; i < EEPROM_CHECKPOINT_SLOTS; i++) {
+    eeprom_busy_wait();
+    eeprom_update_word(reinterpret_cast<uint16_t *>(eeprom_slot_addr(i)), 0);
+  }
+}
 
-    case BS_NO_STATE:   // on the pad
-    {
-      // simply flow into default state
-    }
+// reads both SD checkpoint slots and re-initializes the lab to the
+// newest valid one, unless the EEPROM already gave us something as
+// new. hot says whether it did. returns true if the SD copy was used
+bool restore_state(bool hot) {
+  #ifndef DEBUG
+  if (!state_file_open()) {
+    log_msg(state.last_blue_time, EV_NO_STATE_FILE);
+    return false;
+  }
 
-    default:            // every other state we don't really care about (MECO, etc)
-    {
-      if (!check_lab_state(LS_IDLING_M)) {
-        state.lab_state |= LS_IDLING_M;
-        record_state();
-      }
+  Checkpoint cp;
+  bool found = false;
+  for (uint8_t slot = 0; slot < CHECKPOINT_SLOTS; slot++) {
+    Checkpoint slot_cp;
+    state_file.seek(static_cast<uint32_t>(slot) * CHECKPOINT_SLOT_SIZE);
+    if (state_file.read(&slot_cp, sizeof(slot_cp)) != sizeof(slot_cp)
+        || !checkpoint_valid(slot_cp)) {
+      continue;
+    }
+    // sequence numbers wrap, so compare by difference
+    if (!found || static_cast<int16_t>(slot_cp.seq - cp.seq) > 0) {
+      cp = slot_cp;
+      found = true;
     }
-    break;
   }
 
-  // assign last state now so that we can capture
-  // any updates to state on next loop
-  state.last_blue_state = state.blue_state;
+  if (!found || (hot && static_cast<int16_t>(cp.seq - checkpoint_seq) <= 0)) {
+    return false;
+  }
+  apply_checkpoint(cp);
+  return true;
+  #else
+  (void) hot;   // DEBUG builds keep no checkpoint on the card
+  return false;
+  #endif
+}
+
+// checkpoints the current lab state. the EEPROM ring gets it in the
+// background straight away, and the SD copy waits for the checkpoint
+// task to find a card window, so the caller never waits on the card.
+// once cleaning is done the checkpoints have been cleared for the
+// next power up to be cold, and nothing is written again
+void record_state() {
+  #ifndef DEBUG
+  if (check_lab_state(LS_CLEANED_M)) {
+    return;
+  }
+  checkpoint_seq++;
+  checkpoint_blue_millis = last_blue_millis;
+  Checkpoint cp;
+  make_checkpoint(cp);
+  eeprom_record_state(cp);
+
+  if (state_file) {
+    checkpoint_pending = true;
+    task_in(TASK_CHECKPOINT, 0);
+  }
+  #endif
+}
+
+// writes the newest checkpoint over the older SD checkpoint slot,
+// a single sector write
+void checkpoint_sync() {
+  PROF_BEGIN(start);
+  checkpoint_pending = false;
+  if (state_file) {
+    state_file.seek(static_cast<uint32_t>(checkpoint_cp.seq % CHECKPOINT_SLOTS) * CHECKPOINT_SLOT_SIZE);
+    state_file.write(reinterpret_cast<const uint8_t *>(&checkpoint_cp), sizeof(checkpoint_cp));
+    state_file.flush();
+  }
+  PROF_END(PROF_RECORD, start);
+}
+
+// true if c is one of the BS_* phase characters. these never
+// appear in the numeric fields, so they also mark frame starts
+bool valid_blue_state(const char c) {
+  return c >= BS_NO_STATE && c <= BS_MISSION_END;
+}
+
+// forget everything about the current frame
+void parser_reset() {
+  parser.field = 0;
+  parser.field_len = 0;
+  parser.frame_len = 0;
+  parser.rejected = false;
+  parser.frac_digits = -1;
+  parser.negative = false;
+  parser.value = 0;
+  parser.time = no_blue_time;
+}
+
+// accumulates one character of a decimal time field into t,
+// keeping milliseconds and dropping any finer digits.
+// returns false if c cannot be part of the field
+bool blue_time_take_char(BlueTime &t, int8_t &frac_digits, const char c) {
+  if (c == '.') {
+    if (frac_digits >= 0) {
+      return false;
+    }
+    frac_digits = 0;
+    return true;
+  }
+  if (c < '0' || c > '9') {
+    return false;
+  }
+
+  uint8_t d = c - '0';
+  if (frac_digits < 0) {
+    if (t.sec > (UINT32_MAX - d) / 10) {
+      return false;  // would overflow
+    }
+    t.sec = t.sec * 10 + d;
+  } else if (frac_digits < 3) {
+    t.msec = t.msec * 10 + d;
+    frac_digits++;
+  }
+  return true;
+}
+
+// scales the fractional digits accumulated so far up to milliseconds
+void blue_time_finish(BlueTime &t, int8_t frac_digits) {
+  for (int8_t i = frac_digits < 0 ? 0 : frac_digits; i < 3; i++) {
+    t.msec *= 10;
+  }
+}
+
+// accumulates one character of a signed decimal field into v, in
+// thousandths, dropping any finer digits. returns false if c cannot
+// be part of the field
+bool value_take_char(int32_t &v, int8_t &frac_digits, bool &negative, const bool first, const char c) {
+  if (c == '-') {
+    if (!first) {
+      return false;
+    }
+    negative = true;
+    return true;
+  }
+  if (c == '.') {
+    if (frac_digits >= 0) {
+      return false;
+    }
+    frac_digits = 0;
+    return true;
+  }
+  if (c < '0' || c > '9') {
+    return false;
+  }
+
+  if (frac_digits < 0) {
+    if (v > (INT32_MAX / 1000 - 1 - (c - '0')) / 10) {
+      return false;  // would overflow once scaled
+    }
+    v = v * 10 + (c - '0');
+  } else if (frac_digits < 3) {
+    v = v * 10 + (c - '0');
+    frac_digits++;
+  }
+  return true;
+}
+
+// true if field f is converted and kept
+inline bool field_subscribed(const uint8_t f) {
+  return FIELD_SUBSCRIBED & FIELD_BIT(f);
+}
+
+// converts one character of the current field, if we subscribe
+// to it. returns false if the character does not fit the field
+bool parser_take_char(const char c) {
+  switch (parser.field) {
+    case FIELD_PHASE:
+      parser.phase = c;
+      return parser.field_len == 0 && valid_blue_state(c);
+
+    case FIELD_TIME:
+      return blue_time_take_char(parser.time, parser.frac_digits, c);
+
+    default:
+      if (!field_subscribed(parser.field)) {
+        return true;  // nothing to convert
+      }
+      if (FIELD_BIT(parser.field) & FIELD_FLAGS_M) {
+        parser.value = c - '0';
+        return parser.field_len == 0 && (c == '0' || c == '1');
+      }
+      return value_take_char(parser.value, parser.frac_digits, parser.negative, parser.field_len == 0, c);
+  }
+}
+
+// finishes the field that just ended, storing subscribed vehicle
+// fields in the pending state. returns false if it is malformed
+bool parser_end_field() {
+  if (parser.field_len == 0) {
+    return false;
+  }
+  if (parser.field == FIELD_TIME) {
+    blue_time_finish(parser.time, parser.frac_digits);
+  } else if (parser.field != FIELD_PHASE && field_subscribed(parser.field)) {
+    if (FIELD_BIT(parser.field) & FIELD_FLAGS_M) {
+      uint8_t bit = _BV(parser.field - FIELD_WARN_LIFTOFF);
+      parser.vehicle.flags = parser.value ? parser.vehicle.flags | bit : parser.vehicle.flags & ~bit;
+    } else {
+      for (int8_t i = parser.frac_digits < 0 ? 0 : parser.frac_digits; i < 3; i++) {
+        parser.value *= 10;
+      }
+      parser.vehicle.value[field_index(FIELD_SUBSCRIBED & FIELD_VALUES_M, parser.field)] =
+          parser.negative ? -parser.value : parser.value;
+    }
+  }
+
+  // the next field starts from scratch
+  parser.frac_digits = -1;
+  parser.negative = false;
+  parser.value = 0;
+  return true;
+}
+
+// feeds one byte of the serial stream through the tokenizer. once a
+// frame is rejected the rest of it is skipped until the next frame
+void parser_feed(const char c) {
+  // a phase character past the first field starts the next packet.
+  // this closes a packet that arrived back to back with the next one,
+  // and resyncs on the next packet after a rejected or cut-off one
+  if (valid_blue_state(c) && (parser.field > FIELD_PHASE || parser.rejected)) {
+    parser_end_frame();
+  }
+
+  if (parser.rejected) {
+    return;
+  }
+  if (++parser.frame_len > MAX_FRAME_SIZE) {
+    parser.rejected = true;
+    return;
+  }
+
+  if (c == DELIMITER) {
+    if (!parser_end_field() || ++parser.field >= NUM_FIELDS) {
+      parser.rejected = true;
+    }
+    parser.field_len = 0;
+  } else if (c < ' ' || c > '~' || parser.field_len == MAX_FIELD_SIZE
+             || !parser_take_char(c)) {
+    parser.rejected = true;
+  } else {
+    parser.field_len++;
+  }
+}
+
+// closes out the current frame and, if it was well formed,
+// commits the subscribed fields to the lab state
+void parser_end_frame() {
+  if (!parser.rejected && parser_end_field() && parser.field == NUM_FIELDS - 1) {
+    state.blue_state = parser.phase;
+    state.last_blue_time = parser.time;
+    last_blue_millis = millis();
+    vehicle_prev = vehicle;
+    vehicle = parser.vehicle;
+    vehicle_millis = last_blue_millis;
+    #ifdef ACCEL_TRIGGER
+      accel_gate_update();
+    #endif
+    if (!phase_clock.synced) {
+      phase_clock_sync();
+      phase_clock.synced = true;
+    }
+  }
+  parser_reset();
+}
+
+#ifdef ACCEL_TRIGGER
+// value of subscribed numeric field f in the newest packet
+inline int32_t vehicle_value(const uint8_t f) {
+  return vehicle.value[field_index(FIELD_SUBSCRIBED & FIELD_VALUES_M, f)];
+}
+
+// feeds the newest packet's acceleration through the gate's filter,
+// and opens or closes the gate once the level has held long enough
+void accel_gate_update() {
+  int32_t x = labs(vehicle_value(FIELD_ACC_X)) + labs(vehicle_value(FIELD_ACC_Y))
+            + labs(vehicle_value(FIELD_ACC_Z));
+  AccelGate &g = accel_gate;
+  if (g.packets == 0) {
+    g.level = x;
+  } else {
+    g.level += (x - g.level) >> ACCEL_FILTER_SHIFT;
+  }
+  if (g.packets < ACCEL_SETTLE) {
+    g.packets++;
+    return;
+  }
+
+  bool crossing = g.quiet ? g.level > ACCEL_LOUD : g.level < ACCEL_QUIET;
+  if (!crossing) {
+    g.crossing = false;
+  } else if (!g.crossing) {
+    g.crossing = true;
+    g.since = last_blue_millis;
+  } else if (last_blue_millis - g.since >= ACCEL_HOLD_TIME) {
+    g.quiet = !g.quiet;
+    g.crossing = false;
+    uint16_t level = g.level > 0xffff ? 0xffff : g.level;
+    log_count(state.last_blue_time, g.quiet ? EV_ACCEL_QUIET : EV_ACCEL_LOUD, level);
+  }
+}
+#endif  // ACCEL_TRIGGER
+
+// tokenizes whatever has arrived in the receive buffer, a few bytes
+// per call. never blocks. the core drops bytes silently once its
+// buffer is full, so a full buffer is counted instead
+void read_serial_input() {
+  int waiting = Serial.available();
+  if (waiting > 0) {
+    last_rx_time = millis();
+    if (waiting >= SERIAL_RX_BUFFER_SIZE - 1) {
+      rx_full++;
+    }
+  }
+
+  for (uint8_t i = 0; i < RX_DRAIN_PER_LOOP; i++) {
+    int c = Serial.read();
+    if (c < 0) {
+      break;
+    }
+    parser_feed(c);
+  }
+
+  if (parser.frame_len == 0) {
+    return;
+  }
+
+  // the last packet of a burst has no following phase character,
+  // so close it once the line has gone idle
+  if (Serial.available() > 0 || millis() - last_rx_time < FRAME_GAP_TIME) {
+    return;
+  }
+  parser_end_frame();
+}
+
+// get the newest environmental data from the ADC scan. Stores
+// results in EnvData struct env_data
+void read_sensors(EnvData &env_data) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    env_data.curr_raw = adc_latest[ADC_CURR];
+    env_data.volt_raw = adc_latest[ADC_VOLT];
+    env_data.temp_raw = adc_latest[ADC_TEMP];
+  }
+}
+
+// sensor conversions from raw ADC counts. decode_data.py
+// applies the same ones to the data file
+float curr_from_raw(uint16_t raw) {
+  return raw * (V_REF / ADC_MAX) / CURR_GAIN_CONSTANT;
+}
+
+float volt_from_raw(uint16_t raw) {
+  return V_REF - raw * (V_REF / ADC_MAX);
+}
+
+float temp_from_raw(uint16_t raw) {
+  return raw * (V_REF / ADC_MAX) * 100;
+}
+
+// true if the data file block at index holds samples. blocks are
+// written in order, so the used ones always come first
+bool data_block_used(uint16_t index) {
+  uint16_t magic = 0;
+  data_file.seek(static_cast<uint32_t>(index) * DATA_BLOCK_SIZE);
+  return data_file.read(&magic, sizeof(magic)) == sizeof(magic) && magic == DATA_MAGIC;
+}
+
+// binary searches the data file for its first unused block
+uint16_t data_log_find_end() {
+  uint16_t lo = 0;
+  uint16_t hi = data_file.size() / DATA_BLOCK_SIZE;
+  while (lo < hi) {
+    uint16_t mid = lo + (hi - lo) / 2;
+    if (data_block_used(mid)) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// opens the session's data file and positions the log at its first
+// unused block
+bool data_log_open() {
+  char path[13];
+  session_path(path, DATA_FILE_PREFIX, session);
+  data_file = SD.open(path, BLOCK_FILE_MODE);
+  if (!data_file) {
+    return false;
+  }
+  data_block_index = data_log_find_end();
+  data_header.count = 0;
+  return true;
+}
+
+// makes sure DATA_FILE_BLOCKS zeroed blocks follow the last used one,
+// so that appends during flight never have to grow the file. slow,
+// only run on a cold start before the data stream begins
+void data_log_prealloc() {
+  #ifndef DEBUG
+  if (!data_log_open()) {
+    log_msg(state.last_blue_time, EV_NO_DATA_FILE);
+    return;
+  }
+  file_prealloc(data_file, data_block_index + DATA_FILE_BLOCKS, 0);
+  data_file.close();
+  #endif
+}
+
+// where byte offset of data file block index is in the file
+inline uint32_t data_offset(const uint16_t index, const uint16_t offset) {
+  return static_cast<uint32_t>(index) * DATA_BLOCK_SIZE + offset;
+}
+
+// zeroes block index of f, growing the file if the block is past its end
+void data_block_clear(File &f, const uint16_t index) {
+  file_fill(f, data_offset(index, 0), data_offset(index + 1, 0), 0);
+}
+
+// writes sample i of block index of f in place, and its vehicle state
+void data_block_put(File &f, const uint16_t index, const uint8_t i,
+                    const Sample &sample, const VehicleState &v) {
+  f.seek(data_offset(index, offsetof(DataBlock, samples) + i * sizeof(Sample)));
+  f.write(reinterpret_cast<const uint8_t *>(&sample), sizeof(sample));
+  f.seek(data_offset(index, offsetof(DataBlock, vehicle) + i * sizeof(VehicleState)));
+  f.write(reinterpret_cast<const uint8_t *>(&v), sizeof(v));
+}
+
+// folds len bytes of f from pos into crc, CRC_CHUNK bytes at a time
+uint16_t file_crc(File &f, const uint32_t pos, uint16_t len, uint16_t crc) {
+  uint8_t buf[CRC_CHUNK];
+  f.seek(pos);
+  while (len > 0) {
+    uint16_t n = len < sizeof(buf) ? len : sizeof(buf);
+    f.read(buf, n);
+    crc = crc16_update(crc, buf, n);
+    len -= n;
+  }
+  return crc;
+}
+
+// writes header h over block index of f and seals it with the CRC
+// of h and the samples it counts. they are read back from the
+// sector the SD library has cached, so this costs no card access
+void data_block_seal(File &f, const uint16_t index, const DataHeader &h) {
+  f.seek(data_offset(index, 0));
+  f.write(reinterpret_cast<const uint8_t *>(&h), sizeof(h));
+  uint16_t crc = crc16(&h, sizeof(h));
+  crc = file_crc(f, data_offset(index, offsetof(DataBlock, samples)), h.count * sizeof(Sample), crc);
+  crc = file_crc(f, data_offset(index, offsetof(DataBlock, vehicle)), h.count * sizeof(VehicleState), crc);
+  f.seek(data_offset(index, offsetof(DataBlock, crc)));
+  f.write(reinterpret_cast<const uint8_t *>(&crc), sizeof(crc));
+}
+
+// seals the block being filled. a full block moves the log on to
+// the next one
+void data_log_commit() {
+  if (data_header.count == 0) {
+    return;
+  }
+  data_header.magic = DATA_MAGIC;
+  data_header.version = DATA_VERSION;
+  data_header.seq = data_block_index;
+  data_block_seal(data_file, data_block_index, data_header);
+  data_flush.pending = 0;
+
+  if (data_header.count == SAMPLES_PER_BLOCK) {
+    data_block_index++;
+    data_header.count = 0;
+  }
+}
+
+// writes out any partial block and closes the data file
+void data_log_close() {
+  if (data_file) {
+    data_log_commit();
+    data_file.close();
+  }
+}
+
+// takes a sample every 1/SAMPLE_RATE_HZ s, however busy loop() is
+ISR(TIMER1_COMPA_vect) {
+  uint8_t next = (sample_fifo.head + 1) & SAMPLE_FIFO_MASK;
+  if (next == sample_fifo.tail) {
+    sample_fifo.dropped++;
+    return;
+  }
+  RawSample &sample = sample_fifo.buf[sample_fifo.head];
+  read_sensors(sample.env_data);
+  sample.time = millis();
+  sample_fifo.head = next;
+}
+
+// start pacing samples off Timer1 in CTC mode
+void sampler_start() {
+  adc_start();
+  sample_fifo.head = sample_fifo.tail = 0;
+  sample_fifo.dropped = 0;
+  TCCR1A = 0;
+  TCCR1B = _BV(WGM12) | _BV(CS11) | _BV(CS10);  // CTC, clk/64
+  OCR1A = SAMPLE_TIMER_TOP;
+  TCNT1 = 0;
+  TIMSK1 = _BV(OCIE1A);
+}
+
+// stop taking samples. anything still in the fifo can be logged
+void sampler_stop() {
+  TIMSK1 = 0;
+  TCCR1B = 0;
+  adc_stop();
+}
+
+bool sampler_running() {
+  return TIMSK1 & _BV(OCIE1A);
+}
+
+// take the oldest sample out of the fifo. returns false if it is empty
+bool sample_fifo_pop(Sample &sample) {
+  if (sample_fifo.tail == sample_fifo.head) {
+    return false;
+  }
+  const RawSample &raw = sample_fifo.buf[sample_fifo.tail];
+  sample.time = raw.time;
+  sample.env_data = raw.env_data;
+  sample_fifo.tail = (sample_fifo.tail + 1) & SAMPLE_FIFO_MASK;
+  return true;
+}
+
+// write every sample the timer has taken so far to file
+void log_samples() {
+  Sample sample;
+  while (sample_fifo_pop(sample)) {
+    sample.lab_state = state.lab_state;
+
+    // the vehicle state that was current when it was taken. time
+    // since the newest packet is mod 2^32, as millis() wraps
+    const VehicleState &v = sample.time - vehicle_millis < 0x80000000UL ? vehicle : vehicle_prev;
+    #ifdef ADAPTIVE_LOG
+      door_feed(sample, v);
+    #else
+      log_sensor_data(sample, v);
+    #endif
+  }
+}
+
+#ifdef ADAPTIVE_LOG
+// raw reading i of e: 0 voltage, 1 current, 2 temperature
+inline uint16_t env_raw(const EnvData &e, const uint8_t i) {
+  return i == 0 ? e.volt_raw : (i == 1 ? e.curr_raw : e.temp_raw);
+}
+
+// writes sample out and swings the door shut around it
+void door_keep(const Sample &sample, const VehicleState &v) {
+  log_sensor_data(sample, v);
+  door.kept = sample;
+  door.open = true;
+  door.holding = false;
+  door.count++;
+  for (uint8_t i = 0; i < 3; i++) {
+    door.up_d[i] = 0;
+    door.lo_d[i] = 0;
+  }
+}
+
+// returns false if the line from the kept sample to sample misses
+// any sample in between by more than the tolerance, then widens the
+// door to take sample in. slopes compare as fractions over positive
+// times
+bool door_fits(const Sample &sample) {
+  uint16_t dt = sample.time - door.kept.time;
+  if (dt == 0) {
+    return true;
+  }
+  bool fits = true;
+  for (uint8_t i = 0; i < 3; i++) {
+    int32_t kept = env_raw(door.kept.env_data, i);
+    int32_t n = env_raw(sample.env_data, i) - kept;
+    if ((door.up_d[i] != 0 && n * door.up_d[i] < door.up_n[i] * dt)
+        || (door.lo_d[i] != 0 && n * door.lo_d[i] > door.lo_n[i] * dt)) {
+      fits = false;
+    }
+
+    int32_t up_n = n - door_dev[i];
+    int32_t lo_n = n + door_dev[i];
+    if (door.up_d[i] == 0 || up_n * door.up_d[i] > door.up_n[i] * dt) {
+      door.up_n[i] = up_n;
+      door.up_d[i] = dt;
+    }
+    if (door.lo_d[i] == 0 || lo_n * door.lo_d[i] < door.lo_n[i] * dt) {
+      door.lo_n[i] = lo_n;
+      door.lo_d[i] = dt;
+    }
+  }
+  return fits;
+}
+
+// passes a sample through the swinging door, writing out the ones
+// needed to redraw the signal. a lab state change keeps the samples
+// either side of it, and the door never stays shut past
+// ADAPTIVE_MAX_INTERVAL
+void door_feed(const Sample &sample, const VehicleState &v) {
+  if (!door.open) {
+    door.count = 0;
+    door_keep(sample, v);
+    return;
+  }
+
+  if (!door_fits(sample) || sample.lab_state != door.kept.lab_state) {
+    if (door.holding) {
+      Sample held = door.held;
+      VehicleState held_vehicle = door.held_vehicle;
+      door_keep(held, held_vehicle);
+    }
+    door_fits(sample);
+  }
+
+  if (sample.lab_state != door.kept.lab_state
+      || static_cast<uint32_t>(sample.time - door.kept.time) >= ADAPTIVE_MAX_INTERVAL) {
+    door_keep(sample, v);
+    return;
+  }
+  door.held = sample;
+  door.held_vehicle = v;
+  door.holding = true;
+}
+
+// writes out the last sample once the sampler has stopped, so the
+// record ends where plating did, and logs how many were kept
+void door_close() {
+  if (door.holding) {
+    Sample held = door.held;
+    VehicleState held_vehicle = door.held_vehicle;
+    door_keep(held, held_vehicle);
+  }
+  if (door.open) {
+    log_count(state.last_blue_time, EV_SAMPLES_KEPT, door.count);
+  }
+  door.open = false;
+}
+#endif  // ADAPTIVE_LOG
+
+// write one sensor sample to file, with the vehicle
+// state v that was current when it was taken
+void log_sensor_data(const Sample &sample, const VehicleState &v) {
+  #ifdef DEBUG
+    char s_volt[10];
+    char s_curr[10];
+    char s_temp[10];
+    dtostrf(volt_from_raw(sample.env_data.volt_raw), 5, 3, s_volt);
+    dtostrf(curr_from_raw(sample.env_data.curr_raw), 5, 3, s_curr);
+    dtostrf(temp_from_raw(sample.env_data.temp_raw), 5, 3, s_temp);
+
+    print_blue_time(LOG_OUT, state.last_blue_time);
+    LOG_MSG(DELIMITER);
+    LOG_MSG(sample.time);
+    LOG_MSG(DELIMITER);
+    LOG_MSG(s_volt);
+    LOG_MSG(DELIMITER);
+    LOG_MSG(s_curr);
+    LOG_MSG(DELIMITER);
+    LOG_MSG(s_temp);
+    for (uint8_t i = 0; i < field_count(FIELD_SUBSCRIBED & FIELD_VALUES_M); i++) {
+      LOG_MSG(DELIMITER);
+      LOG_MSG(v.value[i]);
+    }
+    if (FIELD_SUBSCRIBED & FIELD_FLAGS_M) {
+      LOG_MSG(DELIMITER);
+      flush_note(log_flush, LOG_OUT.print(v.flags, HEX));
+    }
+    LOG_MSG_LN();
+  #else
+    // samples go unrecorded with no card. a hot restart
+    // mid-plating comes back without the file open
+    if (!sd_ready || (!data_file && !data_log_open())) {
+      return;
+    }
+
+    DataHeader &header = data_header;
+    if (header.count == 0) {
+      data_block_clear(data_file, data_block_index);
+      header.blue_time = state.last_blue_time;
+      header.blue_millis = last_blue_millis;
+      header.fields = FIELD_SUBSCRIBED;
+      header.rate = SAMPLE_RATE_HZ;
+    }
+    data_block_put(data_file, data_block_index, header.count++, sample, v);
+    flush_note(data_flush, sizeof(sample) + sizeof(v));
+
+    if (header.count == SAMPLES_PER_BLOCK) {
+      data_log_commit();
+    }
+  #endif    // DEBUG
+}
+
+// write t to out as seconds with three decimal places.
+// returns the number of bytes written
+size_t print_blue_time(Print &out, const BlueTime &t) {
+  size_t n = out.print(t.sec);
+  n += out.print('.');
+  if (t.msec < 100) {
+    n += out.print('0');
+  }
+  if (t.msec < 10) {
+    n += out.print('0');
+  }
+  return n + out.print(t.msec);
+}
+
+// queues a log event, dropping it if the ring is full
+void log_push(const BlueTime &t, const EventCode code, const uint16_t n) {
+  uint8_t next = (log_ring.head + 1) & LOG_RING_MASK;
+  if (next == log_ring.tail) {
+    log_ring.dropped++;
+    return;
+  }
+  LogRecord &r = log_ring.buf[log_ring.head];
+  r.code = code;
+  r.time = t;
+  r.lab_state = state.lab_state;
+  r.count = n;
+  log_ring.head = next;
+}
+
+// queue an event and a count for the log file at time t
+void log_count(const BlueTime &t, const EventCode code, const uint16_t n) {
+  log_push(t, code, n);
+}
+
+// queue an event for the log file at time t
+void log_msg(const BlueTime &t, const EventCode code) {
+  log_push(t, code, 0);
+}
+
+// write one event to the log file as its raw record. DEBUG
+// builds print it as <time> <lab state>: <text>[ <count>]
+void log_write(const LogRecord &r) {
+  #ifdef DEBUG
+    BlueTime t = r.time;
+    flush_note(log_flush, print_blue_time(LOG_OUT, t));
+    LOG_MSG(' ');
+    flush_note(log_flush, LOG_OUT.print(r.lab_state, HEX));
+    LOG_MSG(": ");
+    flush_note(log_flush, LOG_OUT.print(reinterpret_cast<const __FlashStringHelper *>(
+        pgm_read_ptr(&event_text[r.code]))));
+    if (pgm_read_byte(&event_counted[r.code])) {
+      LOG_MSG(' ');
+      LOG_MSG(r.count);
+    }
+    LOG_MSG_LN();
+  #else
+    flush_note(log_flush, LOG_OUT.write(reinterpret_cast<const uint8_t *>(&r), sizeof(r)));
+  #endif
+}
+
+// write up to max queued events to the log file, and a
+// note of how many were dropped once the ring has room again
+void log_drain(const uint8_t max) {
+  for (uint8_t i = 0; i < max && log_ring.tail != log_ring.head; i++) {
+    log_write(log_ring.buf[log_ring.tail]);
+    log_ring.tail = (log_ring.tail + 1) & LOG_RING_MASK;
+  }
+
+  if (log_ring.dropped > 0 && log_ring.tail == log_ring.head) {
+    LogRecord r;
+    r.code = EV_LOG_DROPPED;
+    r.time = state.last_blue_time;
+    r.lab_state = state.lab_state;
+    r.count = log_ring.dropped;
+    log_write(r);
+    log_ring.dropped = 0;
+  }
+}
+
+// true while a packet is coming in, when the card should be left alone
+bool serial_busy() {
+  return parser.frame_len > 0 || Serial.available() > 0;
+}
+
+// true while card work can start without running into the next
+// packet, see CARD_WINDOW
+bool card_window() {
+  if (serial_busy()) {
+    return false;
+  }
+  unsigned long since = millis() - last_rx_time;
+  return since < CARD_WINDOW || since >= CARD_QUIET;
+}
+
+// records that bytes more were buffered under f
+void flush_note(FlushState &f, size_t bytes) {
+  if (f.pending == 0) {
+    f.since = millis();
+  }
+  f.pending += bytes;
+}
+
+// true if what is buffered under f has hit the flush policy's limits
+bool flush_due(const FlushState &f, const unsigned long now, const bool force) {
+  return f.pending > 0
+      && (force || f.pending >= FLUSH_BYTES || now - f.since >= FLUSH_INTERVAL);
+}
+
+// pushes buffered log and data bytes to the card when the flush policy
+// calls for it. force flushes everything, regardless of the limits
+void flush_service(const bool force) {
+  #ifndef DEBUG
+  unsigned long now = millis();
+
+  // hold off until the card window, within the deadline
+  bool busy = !card_window();
+  bool overdue = (log_flush.pending > 0 && now - log_flush.since >= FLUSH_DEADLINE)
+              || (data_flush.pending > 0 && now - data_flush.since >= FLUSH_DEADLINE);
+  if (busy && !force && !overdue) {
+    return;
+  }
+
+  if (log_file && flush_due(log_flush, now, force)) {
+    log_file.flush();
+    log_flush.pending = 0;
+  }
+  if (data_file && flush_due(data_flush, now, force)) {
+    data_log_commit();
+    data_file.flush();
+  }
+  #else
+  (void) force;   // DEBUG builds write straight to the console
+  #endif
+}
+
+// check if the bits specified by mask are flipped
+bool check_lab_state(const uint16_t &mask) {
+  return (state.lab_state & mask);
+}
+
+// ms from a to b on the Blue clock. 0 if either is no_blue_time,
+// since an epoch time against 0 overflows a long
+long blue_time_diff(const BlueTime &a, const BlueTime &b) {
+  if ((a.sec == 0 && a.msec == 0) || (b.sec == 0 && b.msec == 0)) {
+    return 0;
+  }
+  return static_cast<long>(b.sec - a.sec) * 1000 + (static_cast<int16_t>(b.msec) - a.msec);
+}
+
+// the Blue time now, going by the newest packet
+void blue_now(BlueTime &t) {
+  unsigned long ms = state.last_blue_time.msec + (millis() - last_blue_millis);
+  t.sec = state.last_blue_time.sec + ms / 1000;
+  t.msec = ms % 1000;
+}
+
+// millis() at which the Blue clock read t
+unsigned long blue_to_millis(const BlueTime &t) {
+  return last_blue_millis - blue_time_diff(t, state.last_blue_time);
+}
+
+// rebuilds the phase clock from the Blue times in state
+void phase_clock_sync() {
+  phase_clock.phase_millis = blue_to_millis(state.phase_time);
+  phase_clock.step_millis = blue_to_millis(state.step_time);
+}
+
+// stamps the entry into blue_state with the packet that announced it
+void phase_enter() {
+  state.phase_time = state.last_blue_time;
+  phase_clock.phase_millis = last_blue_millis;
+}
+
+// stamps the start of a timed lab step
+void step_start() {
+  blue_now(state.step_time);
+  phase_clock.step_millis = millis();
+}
+
+// ms left of a wait of length ms that began at millis() since,
+// 0 once it is over. a start in the future counts as now
+uint16_t time_left(const unsigned long since, const uint16_t length) {
+  long elapsed = static_cast<long>(millis() - since);
+  if (elapsed < 0) {
+    return length;
+  }
+  return elapsed >= length ? 0 : length - elapsed;
+}
+
+// index of the cleaning stage in progress, or
+// CLEAN_STAGES if cleaning has not started yet
+uint8_t cleaning_stage() {
+  for (uint8_t i = 0; i < CLEAN_STAGES; i++) {
+    if (check_lab_state(pgm_read_word(&clean_stages[i].lab_state_m))) {
+      return i;
+    }
+  }
+  return CLEAN_STAGES;
+}
+
+// moves the lab into cleaning stage i, or back to idle outputs
+// once i runs past the last stage
+void enter_cleaning_stage(const uint8_t i) {
+  if (i < CLEAN_STAGES) {
+    CleanStage stage;
+    memcpy_P(&stage, &clean_stages[i], sizeof(stage));
+    state.lab_state |= stage.lab_state_m;
+    step_start();
+    actuators_commit((actuators & ~ACT_CLEANING_M) | stage.outputs);
+    log_count(state.last_blue_time, EV_CLEAN, i + 1);
+  } else {
+    actuators_off(ACT_CLEANING_M);
+  }
+}
+
+// runs the cleaning sequence from clean_stages, keeping the lab
+// timer armed for the end of the stage in progress. returns true
+// on the pass where the last stage finishes
+bool cleaning_step() {
+  uint8_t i = cleaning_stage();
+
+  if (i == CLEAN_STAGES) {
+    // we haven't done any cleaning yet
+    state.lab_state &= ~LS_IDLING_M;
+    enter_cleaning_stage(0);
+    record_state();
+    task_in(TASK_LAB, pgm_read_word(&clean_stages[0].length));
+    return false;
+  }
+
+  uint16_t left = time_left(phase_clock.step_millis, pgm_read_word(&clean_stages[i].length));
+  if (left > 0) {
+    task_in(TASK_LAB, left);
+    return false;
+  }
+  state.lab_state &= ~pgm_read_word(&clean_stages[i].lab_state_m);
+  enter_cleaning_stage(i + 1);
+  if (i + 1 < CLEAN_STAGES) {
+    record_state();
+    task_in(TASK_LAB, pgm_read_word(&clean_stages[i + 1].length));
+    return false;
+  }
+  return true;
+}
+
+// sets up task i to call run, every period ms starting now,
+// or only when armed with task_in() if period is 0
+void task_init(const uint8_t i, void (*run)(), const uint16_t period) {
+  tasks[i].run = run;
+  tasks[i].period = period;
+  tasks[i].due = millis();
+  tasks[i].armed = period > 0;
+}
+
+// arms task i to run ms from now, replacing its old deadline
+void task_in(const uint8_t i, const uint16_t ms) {
+  tasks[i].due = millis() + ms;
+  tasks[i].armed = true;
+}
+
+void task_cancel(const uint8_t i) {
+  tasks[i].armed = false;
+}
+
+// runs every task whose deadline has passed, in slot order. a
+// periodic task that fell more than a period behind skips the
+// runs it missed rather than bursting to catch up
+void sched_run() {
+  #ifdef PROFILE
+    unsigned long pass_start = micros();
+    char phase = state.blue_state;
+    bool ran = false;
+  #endif
+
+  for (uint8_t i = 0; i < NUM_TASKS; i++) {
+    Task &t = tasks[i];
+    unsigned long now = millis();
+    if (!t.armed || static_cast<long>(now - t.due) < 0) {
+      continue;
+    }
+
+    if (t.period == 0) {
+      t.armed = false;
+    } else {
+      t.due += t.period;
+      if (static_cast<long>(now - t.due) >= 0) {
+        t.due = now + t.period;
+      }
+    }
+    PROF_BEGIN(start);
+    t.run();
+    PROF_END(i, start);
+    #ifdef PROFILE
+      ran = true;
+    #endif
+  }
+
+  #ifdef PROFILE
+    if (ran) {
+      unsigned long us = micros() - pass_start;
+      prof_add(PROF_PASS, us);
+      prof_add_phase(phase, us);
+    }
+  #endif
+}
+
+// true if any task's deadline has passed
+bool sched_due() {
+  unsigned long now = millis();
+  for (uint8_t i = 0; i < NUM_TASKS; i++) {
+    if (tasks[i].armed && static_cast<long>(now - tasks[i].due) >= 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// idles the core until the next interrupt when nothing is due.
+// idle mode keeps the UART, timers and ADC clocked, so a received
+// byte, a sample tick or the ~1 ms millis() tick wakes us back up.
+// the checks run with interrupts off and sei() lets exactly one
+// more instruction through, so a wakeup can't slip in between the
+// check and the sleep
+void sched_idle() {
+  set_sleep_mode(SLEEP_MODE_IDLE);
+  cli();
+  if (sched_due() || Serial.available() > 0) {
+    sei();
+    return;
+  }
+  sleep_enable();
+  sei();
+  sleep_cpu();
+  sleep_disable();
+}
+
+// takes in Blue packets, and steps the lab as soon as the phase
+// changes or the first packet after a hot restart corrects its waits
+void serial_task() {
+  bool synced = phase_clock.synced;
+  #ifdef ACCEL_TRIGGER
+    bool quiet = accel_gate.quiet;
+  #endif
+  read_serial_input();
+  bool step = state.blue_state != state.last_blue_state || synced != phase_clock.synced;
+  #ifdef ACCEL_TRIGGER
+    // the gate only moves plating between coast start and coast end
+    step |= quiet != accel_gate.quiet
+            && (state.blue_state == BS_COAST_START || state.blue_state == BS_APOGEE);
+  #endif
+  if (step) {
+    lab_step();
+  }
+
+  // times the receive buffer overflowed, as one counted event
+  if (rx_full > 0) {
+    log_count(state.last_blue_time, EV_RX_DROPPED, rx_full);
+    rx_full = 0;
+  }
+}
+
+void samples_task() {
+  log_samples();
+}
+
+#ifdef MEM_STATS
+// top of the heap, the lowest address the stack may grow down to
+uint8_t *mem_heap_end() {
+  return __brkval ? __brkval : &__heap_start;
+}
+
+// bytes between the top of the heap and the stack pointer now
+uint16_t mem_free() {
+  return static_cast<uintptr_t>(SP) - reinterpret_cast<uintptr_t>(mem_heap_end());
+}
+
+// fills the free RAM under the stack with MEM_CANARY, so
+// mem_headroom() can tell how deep the stack has been
+void mem_paint() {
+  uint8_t *end = reinterpret_cast<uint8_t *>(static_cast<uintptr_t>(SP - MEM_PAINT_GUARD));
+  for (uint8_t *p = mem_heap_end(); p < end; p++) {
+    *p = MEM_CANARY;
+  }
+}
+
+// bytes above the heap the stack has never reached since mem_paint()
+uint16_t mem_headroom() {
+  uint8_t *start = mem_heap_end();
+  uint8_t *end = reinterpret_cast<uint8_t *>(static_cast<uintptr_t>(SP));
+  uint8_t *p = start;
+  while (p < end && *p == MEM_CANARY) {
+    p++;
+  }
+  return p - start;
+}
+
+// logs the stack headroom each time it hits a new low
+void mem_task() {
+  uint16_t headroom = mem_headroom();
+  if (headroom + MEM_REPORT_STEP <= mem_low_headroom) {
+    mem_low_headroom = headroom;
+    log_count(state.last_blue_time, EV_STACK_HEADROOM, headroom);
+  }
+}
+#endif  // MEM_STATS
+
+#ifdef PROFILE
+// us clipped to what a table entry holds
+inline uint16_t prof_clip(const unsigned long us) {
+  return us < PROF_SATURATE ? us : PROF_SATURATE;
+}
+
+// adds one run of us microseconds to a section. once its count
+// saturates the section holds still, so the mean stays that of the
+// runs counted
+void prof_add(const uint8_t i, const unsigned long us) {
+  ProfSection &p = prof_sections[i];
+  if (p.count == PROF_SATURATE) {
+    return;
+  }
+  uint16_t t = prof_clip(us);
+  if (p.count == 0 || t < p.min) {
+    p.min = t;
+  }
+  if (t > p.max) {
+    p.max = t;
+  }
+  p.total += us;
+  p.count++;
+}
+
+// adds one scheduler pass of us microseconds to phase's breakdown
+void prof_add_phase(const char phase, const unsigned long us) {
+  if (!valid_blue_state(phase)) {
+    return;
+  }
+  ProfPhase &p = prof_phases[phase - BS_NO_STATE];
+  if (p.count == PROF_SATURATE) {
+    return;
+  }
+  if (prof_clip(us) > p.max) {
+    p.max = prof_clip(us);
+  }
+  p.total += us;
+  p.count++;
+}
+
+// writes the profile as text, a line per section
+// (name count min mean max) then a line per phase
+// seen (phase count mean max)
+void prof_dump(Print &out) {
+  for (uint8_t i = 0; i < PROF_SECTIONS; i++) {
+    const ProfSection &p = prof_sections[i];
+    out.print(reinterpret_cast<const __FlashStringHelper *>(prof_names[i]));
+    out.print(' ');
+    out.print(p.count);
+    out.print(' ');
+    out.print(p.min);
+    out.print(' ');
+    out.print(p.count ? p.total / p.count : 0);
+    out.print(' ');
+    out.println(p.max);
+  }
+
+  for (uint8_t i = 0; i < PROF_PHASES; i++) {
+    const ProfPhase &p = prof_phases[i];
+    if (p.count == 0) {
+      continue;
+    }
+    out.print(static_cast<char>(BS_NO_STATE + i));
+    out.print(' ');
+    out.print(p.count);
+    out.print(' ');
+    out.print(p.total / p.count);
+    out.print(' ');
+    out.println(p.max);
+  }
+}
+
+// writes the profile to the console in DEBUG builds,
+// or to its own file, since log_file is closed by now
+void prof_report() {
+  #ifdef DEBUG
+    prof_dump(Serial);
+  #else
+    File f = SD.open(PROF_FILE_PATH, FILE_WRITE);
+    if (f) {
+      prof_dump(f);
+      f.close();
+    }
+  #endif
+}
+#endif  // PROFILE
+
+#ifdef SD_QUALIFY
+// adds one operation of us microseconds to its distribution
+void qual_add(const uint8_t i, const unsigned long us) {
+  QualOp &q = qual_ops[i];
+  if (q.count == 0 || us < q.min) {
+    q.min = us;
+  }
+  if (us > q.max) {
+    q.max = us;
+  }
+  q.total += us;
+  q.count++;
+
+  uint8_t b = 0;
+  for (unsigned long limit = QUAL_BUCKET_BASE; b < QUAL_BUCKETS - 1 && us >= limit; limit <<= 2) {
+    b++;
+  }
+  if (q.hist[b] < 0xffff) {
+    q.hist[b]++;
+  }
+}
+
+// one round of every operation against the scratch file. the
+// tables live in the sector buffer, so the card is handed them,
+// which times the same as any other bytes.
+// returns false if the card stopped responding
+bool qual_round(const uint16_t round) {
+  uint8_t *buf = qual_buf;
+
+  // appends, the way log_file is written
+  unsigned long start = micros();
+  File f = SD.open(QUAL_SCRATCH_PATH, FILE_WRITE);
+  qual_add(QUAL_OPEN, micros() - start);
+  if (!f) {
+    return false;
+  }
+  for (uint16_t n = 0; n < FLUSH_BYTES; n += sizeof(LogRecord)) {
+    start = micros();
+    f.write(buf, sizeof(LogRecord));
+    qual_add(QUAL_LOG, micros() - start);
+  }
+  start = micros();
+  f.flush();
+  qual_add(QUAL_LOG_FLUSH, micros() - start);
+
+  for (uint8_t k = 0; k < QUAL_WRITE_SIZES; k++) {
+    start = micros();
+    f.write(buf, 32 << k);
+    f.flush();
+    qual_add(QUAL_WRITE + k, micros() - start);
+  }
+  start = micros();
+  f.close();
+  qual_add(QUAL_CLOSE, micros() - start);
+
+  // sector rewrites in place, the way state_file and data_file are
+  start = micros();
+  f = SD.open(QUAL_SCRATCH_PATH, BLOCK_FILE_MODE);
+  qual_add(QUAL_OPEN, micros() - start);
+  if (!f) {
+    return false;
+  }
+  start = micros();
+  f.seek(static_cast<uint32_t>(round % CHECKPOINT_SLOTS) * CHECKPOINT_SLOT_SIZE);
+  f.write(buf, sizeof(Checkpoint));
+  f.flush();
+  qual_add(QUAL_CHECKPOINT, micros() - start);
+
+  // a block filled in place and sealed, the way data_file is
+  uint16_t index = round % (f.size() / DATA_BLOCK_SIZE);
+  DataHeader header;
+  memcpy(&header, buf, sizeof(header));
+  header.count = SAMPLES_PER_BLOCK;
+  for (uint8_t i = 0; i < SAMPLES_PER_BLOCK; i++) {
+    start = micros();
+    data_block_put(f, index, i, *reinterpret_cast<const Sample *>(buf),
+                   *reinterpret_cast<const VehicleState *>(buf + sizeof(Sample)));
+    qual_add(QUAL_SAMPLE, micros() - start);
+  }
+  start = micros();
+  data_block_seal(f, index, header);
+  f.flush();
+  qual_add(QUAL_SEAL, micros() - start);
+
+  start = micros();
+  f.close();
+  qual_add(QUAL_CLOSE, micros() - start);
+  return true;
+}
+
+// writes the results as text, a line per operation
+// (name count min mean max histogram...)
+void qual_dump(Print &out) {
+  for (uint8_t i = 0; i < QUAL_OPS; i++) {
+    const QualOp &q = qual_ops[i];
+    out.print(reinterpret_cast<const __FlashStringHelper *>(qual_names[i]));
+    out.print(' ');
+    out.print(q.count);
+    out.print(' ');
+    out.print(q.min);
+    out.print(' ');
+    out.print(q.count ? q.total / q.count : 0);
+    out.print(' ');
+    out.print(q.max);
+    for (uint8_t b = 0; b < QUAL_BUCKETS; b++) {
+      out.print(' ');
+      out.print(q.hist[b]);
+    }
+    out.println();
+  }
+}
+
+// runs the qualification and replaces QUAL_FILE_PATH with the
+// results. DEBUG builds print them to the console as well
+void qual_run() {
+  SD.remove(QUAL_SCRATCH_PATH);
+  for (uint16_t round = 0; round < QUAL_ROUNDS && qual_round(round); round++) {
+  }
+  SD.remove(QUAL_SCRATCH_PATH);
+
+  #ifdef DEBUG
+    qual_dump(Serial);
+  #endif
+  SD.remove(QUAL_FILE_PATH);
+  File f = SD.open(QUAL_FILE_PATH, FILE_WRITE);
+  if (f) {
+    qual_dump(f);
+    f.close();
+  }
+}
+#endif  // SD_QUALIFY
+
+// writes queued log events out in the gaps between packets. with
+// no card they stay queued, and what the ring turns away is counted
+void log_task() {
+  #ifndef DEBUG
+    if (!sd_ready) {
+      return;
+    }
+  #endif
+  if (!serial_busy()) {
+    log_drain(LOG_DRAIN_PER_PASS);
+  }
+}
+
+void flush_task() {
+  flush_service(flush_forced);
+  flush_forced = false;
+}
+
+// tries again for a card that was missing at boot, in a gap between
+// packets. an empty slot costs the probe's ~2 ms a try, and a card
+// that answers it but won't come up gets SD_TRIES. once the card is
+// up the state file gets the current state straight away, and the
+// data file is opened when the next sample comes in. there is no time
+// to preallocate, so the session's files grow as they are written
+void sd_task() {
+  if (!card_window()) {
+    // packets come at a fixed rate, so waiting out a whole
+    // period could land on one every time
+    task_in(TASK_SD, CARD_RETRY);
+    return;
+  }
+  if (!sd_init() || !session_open(false)) {
+    if (sd_fails >= SD_TRIES) {
+      task_cancel(TASK_SD);
+      log_count(state.last_blue_time, EV_SD_GAVE_UP, sd_fails);
+    }
+    return;
+  }
+  task_cancel(TASK_SD);
+  if (state_file_open()) {
+    record_state();
+  } else {
+    log_msg(state.last_blue_time, EV_NO_STATE_FILE);
+  }
+}
+
+// refreshes the checkpoint with the newest Blue time, so a hot
+// restart resumes from close to where we were, and copies the newest
+// checkpoint to the state file once there is a card window. a copy
+// still waiting goes out before the next refresh
+void checkpoint_task() {
+  if (!checkpoint_pending && checkpoint_blue_millis != last_blue_millis) {
+    record_state();
+  }
+  if (!checkpoint_pending) {
+    return;
+  }
+  if (!card_window()) {
+    task_in(TASK_CHECKPOINT, CARD_RETRY);
+    return;
+  }
+  checkpoint_sync();
+}
+
+// state machine predicated on state of blue rocket. runs when the
+// phase changes, at boot, and when the lab timer fires. every wait
+// is measured against the phase clock, so an extra step only
+// re-arms the timer for the same deadline
+void lab_step() {
+  // check to see if blue's state updated since the last step
+  bool transition = state.blue_state != state.last_blue_state;
+  if (transition) {
+    phase_enter();
+    record_state();
+  }
+
+  switch(state.blue_state) {
+
+    case BS_SEP_COMMANDED:    // CC is free
+    {
+      // have we already primed?
+      if (!check_lab_state(LS_PRIMED_M)) {
+
+        if (!check_lab_state(LS_PRIMING_M)) {
+          // wait until things have settled down after the command
+          uint16_t left = time_left(phase_clock.phase_millis, PRIME_WAIT_TIME);
+          if (left > 0) {
+            task_in(TASK_LAB, left);
+            break;
+          }
+
+          // start priming
+          actuators_on(ACT_MOTOR);
+
+          state.lab_state &= ~LS_IDLING_M;
+          state.lab_state |= LS_PRIMING_M;
+          step_start();
+          record_state();
+
+          log_msg(state.last_blue_time, EV_PRIMING);
+
+          task_in(TASK_LAB, PRIME_TIME);
+        } else {
+          uint16_t left = time_left(phase_clock.step_millis, PRIME_TIME);
+          if (left > 0) {
+            task_in(TASK_LAB, left);
+            break;
+          }
+
+          // stop priming
+          actuators_off(ACT_MOTOR);
+
+          state.lab_state &= ~LS_PRIMING_M;
+          state.lab_state |= (LS_PRIMED_M | LS_IDLING_M);
+          record_state();
+
+          log_msg(state.last_blue_time, EV_PRIMED);
+        }
+      }
+
+    }
+    break;
+
+    case BS_APOGEE:
+    {
+      // do nothing, we want to flow into coast start
+      // since we should still be plating at this point
+    }
+    
+    case BS_COAST_START:
+    {
+      // if primed, start experiment
+      if (check_lab_state(LS_PRIMED_M)) {
+        #ifdef ACCEL_TRIGGER
+          plating_gate();
+        #else
+          plating_start();
+        #endif
+      } else {
+        // TODO: modularize priming
+      }
+    }
+    break;
+
+    case BS_COAST_END:
+    {
+      plating_stop();
+    }
+    break;
+
+    case BS_LANDING:
+    {
+      // flow into safing state since we do the same thing
+    }
+
+    case BS_SAFING:   
+    {
+      if (!check_lab_state(LS_CLEANED_M) && cleaning_step()) {
+        state.lab_state |= LS_CLEANED_M | LS_IDLING_M;
+
+        // clean up whole lab
+        log_msg(state.last_blue_time, EV_CLEANED);
+
+        log_msg(state.last_blue_time, EV_CLEAN_IDLE);
+
+        // close streams
+        if (sd_ready) {
+          log_drain(LOG_RING_SIZE);
+          log_file.close();
+          state_file.close();
+          SD.remove(STATE_FILE_PATH);
+        }
+        eeprom_clear_state();
+        task_cancel(TASK_CHECKPOINT);
+        task_cancel(TASK_SD);
+      }
+    }
+    break;
+
+    case BS_NO_STATE:   // on the pad
+    {
+      // simply flow into default state
+    }
+
+    default:            // every other state we don't really care about (MECO, etc)
+    {
+      if (!check_lab_state(LS_IDLING_M)) {
+        state.lab_state |= LS_IDLING_M;
+        record_state();
+      }
+    }
+    break;
+  }
+
+  #ifdef PROFILE
+    if (transition && state.blue_state == BS_MISSION_END) {
+      prof_report();
+    }
+  #endif
+
+  // everything logged around a phase change goes to the card
+  // with the next flush, once the log task has written it out
+  if (transition) {
+    flush_forced = true;
+  }
+
+  // assign last state now so that we can capture
+  // any updates to state on the next step
+  state.last_blue_state = state.blue_state;
+}
+
+// starts the experiment, or starts it again after a pause. the sampler
+// takes a measurement every 1/SAMPLE_RATE_HZ s and the samples task
+// writes them out
+void plating_start() {
+  if (check_lab_state(LS_PLATED_M)) {
+    return;
+  }
+  if (!check_lab_state(LS_PLATING_M)) {
+    state.lab_state &= ~LS_IDLING_M;
+    state.lab_state |= LS_PLATING_M;
+    actuators_on(ACT_EXPERIMENT);
+
+    #ifndef DEBUG
+      if (sd_ready && !data_file) {
+        data_log_open();
+      }
+    #endif
+    sampler_start();
+    record_state();
+  } else if (!sampler_running()) {
+    // a hot restart mid-plating comes back with the timer stopped
+    sampler_start();
+  }
+}
+
+// ends the experiment for good, whether or not it ever started
+void plating_stop() {
+  if (!(state.lab_state & LS_PLATED_M)) {
+    sampler_stop();
+    actuators_off(ACT_EXPERIMENT);
+
+    state.lab_state |= LS_IDLING_M | LS_PLATED_M;
+    state.lab_state &= ~LS_PLATING_M;
+    record_state();
+
+    log_msg(state.last_blue_time, EV_PLATED);
+    log_msg(state.last_blue_time, EV_PLATING_IDLE);
+
+    // clean up
+    plating_drain();
+    data_log_close();
+  }
+}
+
+// writes out what the stopped sampler left in the fifo
+void plating_drain() {
+  log_samples();
+  #ifdef ADAPTIVE_LOG
+    door_close();
+  #endif
+  if (sample_fifo.dropped > 0) {
+    log_count(state.last_blue_time, EV_SAMPLES_DROPPED, sample_fifo.dropped);
+    sample_fifo.dropped = 0;
+  }
+}
+
+#ifdef ACCEL_TRIGGER
+// turns the experiment off until the gate opens again. plating goes
+// on into the same data file, and PLATED waits for coast end
+void plating_pause() {
+  if (check_lab_state(LS_PLATING_M)) {
+    sampler_stop();
+    actuators_off(ACT_EXPERIMENT);
+
+    state.lab_state |= LS_IDLING_M;
+    state.lab_state &= ~LS_PLATING_M;
+    record_state();
+
+    log_msg(state.last_blue_time, EV_PLATING_IDLE);
+    plating_drain();
+  }
+}
+
+// between coast start and coast end, plating follows the acceleration
+// gate. apogee is quiet whatever the filter says, so plating starts
+// there at the latest and is not cut short before coast end
+void plating_gate() {
+  bool apogee = state.blue_state == BS_APOGEE;
+  if (check_lab_state(LS_PLATING_M) && !accel_gate.quiet && accel_gate.packets == ACCEL_SETTLE && !apogee) {
+    plating_pause();
+  } else if (accel_gate.quiet || apogee || check_lab_state(LS_PLATING_M)) {
+    plating_start();
+  }
+}
+#endif  // ACCEL_TRIGGER
+
+// configures and initializes serial, sd,
+// pump, solenoid, experiment interfaces
+void setup() {
+  #ifdef MEM_STATS
+    mem_paint();
+  #endif
+
+  #ifdef SD_QUALIFY
+    // actuators safe, then nothing but the card
+    power_init();
+    pin_init();
+    #ifdef DEBUG
+      serial_init();
+    #endif
+    if (SD.begin(CHIP_SELECT)) {
+      qual_run();
+    }
+    return;
+  #endif
+
+  // the EEPROM copy tells hot from cold within microseconds
+  // of a reset, before the SD card is even powered up
+  bool hot = eeprom_restore_state();
+
+  // actuators latched safe, or straight back to what the checkpoint
+  // had them doing, before the card gets a chance to hold us up
+  power_init();
+  pin_init();
+  if (hot) {
+    actuators_commit(lab_state_actuators());
+  }
+
+  serial_init();
+  bool card = sd_init();
+  if (!card) {
+    log_msg(state.last_blue_time, EV_NO_SD);
+  }
+
+  // a valid checkpoint in either copy means we reset mid-flight.
+  // the SD copy only wins if the EEPROM write was cut short
+  bool sd_newer = card && restore_state(hot);
+  hot |= sd_newer;
+  if (hot) {
+    log_msg(state.last_blue_time, EV_HOT);
+  } else {
+    // initialize default state
+    state.last_blue_time = no_blue_time;
+    state.phase_time = no_blue_time;
+    state.step_time = no_blue_time;
+    phase_clock.synced = true;
+    state.lab_state  = LS_NO_STATE;
+    state.blue_state = BS_NO_STATE;
+    state.last_blue_state = BS_NO_STATE;
+    session = 0;
+    log_msg(state.last_blue_time, EV_COLD);
+  }
+
+  // a new session's files are laid out now, as the
+  // data stream is still about a minute out
+  if (card) {
+    session_open(!hot);
+  }
+  if (sd_newer) {
+    actuators_commit(lab_state_actuators());
+  }
+
+  task_init(TASK_SERIAL, serial_task, SERIAL_TASK_PERIOD);
+  task_init(TASK_LAB, lab_step, 0);
+  task_init(TASK_SAMPLES, samples_task, SAMPLES_TASK_PERIOD);
+  task_init(TASK_LOG, log_task, LOG_TASK_PERIOD);
+  task_init(TASK_FLUSH, flush_task, FLUSH_TASK_PERIOD);
+  task_init(TASK_CHECKPOINT, checkpoint_task, CHECKPOINT_TASK_PERIOD);
+  task_init(TASK_SD, sd_task, SD_TASK_PERIOD);
+  if (sd_ready) {
+    task_cancel(TASK_SD);
+  }
+  #ifdef MEM_STATS
+    task_init(TASK_MEM, mem_task, MEM_TASK_PERIOD);
+
+    // static data and what is left once everything is up
+    log_count(state.last_blue_time, EV_MEM_STATIC, &__heap_start - reinterpret_cast<uint8_t *>(RAMSTART));
+    log_count(state.last_blue_time, EV_MEM_FREE, mem_free());
+  #endif
+
+  // pick up where a hot restart left off, or settle into idle
+  lab_step();
+}
+
+// runs whatever the scheduler has due, then idles until
+// the next interrupt
+void loop() {
+  #ifdef SD_QUALIFY
+    return;
+  #endif
+  sched_run();
+  sched_idle();
 }
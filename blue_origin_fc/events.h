@@ -0,0 +1,44 @@
+// The log event catalogue. Events are logged as their code, which is
+// their position in this list, so new events only ever go on the end.
+// decode_log.py reads this list to turn logged codes back into text.
+//
+// EVENT(name, text, counted): counted events carry a count
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdint.h>
+
+#define EVENT_LIST(EVENT) \
+  EVENT(EV_SERIAL,          "Serial",         0) \
+  EVENT(EV_SD,              "SD",             0) \
+  EVENT(EV_NO_SD,           "!SD",            0) \
+  EVENT(EV_PINS,            "pins",           0) \
+  EVENT(EV_HOT,             "hot",            0) \
+  EVENT(EV_COLD,            "cold",           0) \
+  EVENT(EV_NO_STATE_FILE,   "!state_file",    0) \
+  EVENT(EV_NO_DATA_FILE,    "!data_file",     0) \
+  EVENT(EV_PRIMING,         "priming",        0) \
+  EVENT(EV_PRIMED,          "!priming",       0) \
+  EVENT(EV_PLATED,          "!plating",       0) \
+  EVENT(EV_PLATING_IDLE,    "plating->idle",  0) \
+  EVENT(EV_SAMPLES_DROPPED, "dropped",        1) \
+  EVENT(EV_CLEAN,           "clean",          1) \
+  EVENT(EV_CLEANED,         "!cleaning",      0) \
+  EVENT(EV_CLEAN_IDLE,      "clean->idle",    0) \
+  EVENT(EV_LOG_DROPPED,     "log dropped",    1) \
+  EVENT(EV_MEM_STATIC,      "static ram",     1) \
+  EVENT(EV_MEM_FREE,        "free ram",       1) \
+  EVENT(EV_STACK_HEADROOM,  "stack headroom", 1) \
+  EVENT(EV_RX_DROPPED,      "rx dropped",     1) \
+  EVENT(EV_ACCEL_QUIET,     "accel quiet",    1) \
+  EVENT(EV_ACCEL_LOUD,      "accel loud",     1) \
+  EVENT(EV_SAMPLES_KEPT,    "samples kept",   1) \
+  EVENT(EV_SESSION,         "session",        1) \
+  EVENT(EV_SD_GAVE_UP,      "SD gave up",     1)
+
+#define EVENT_CODE(name, text, counted) name,
+enum EventCode : uint8_t { EVENT_LIST(EVENT_CODE) NUM_EVENTS };
+#undef EVENT_CODE
+
+#endif  // EVENTS_H
@@ -0,0 +1,49 @@
+// The fields of a Blue telemetry packet, by position, as the payload
+// user's guide lists them. Numeric fields are kept in thousandths of
+// their unit. decode_data.py reads these defines to name the vehicle
+// columns of the data file.
+
+#ifndef FIELDS_H
+#define FIELDS_H
+
+#include <stdint.h>
+
+#define FIELD_PHASE 0
+#define FIELD_TIME 1
+#define FIELD_ALTITUDE 2        // m
+#define FIELD_VEL_X 3           // m/s
+#define FIELD_VEL_Y 4
+#define FIELD_VEL_Z 5
+#define FIELD_ACC_X 6           // m/s^2
+#define FIELD_ACC_Y 7
+#define FIELD_ACC_Z 8
+#define FIELD_ATT_X 9           // attitude
+#define FIELD_ATT_Y 10
+#define FIELD_ATT_Z 11
+#define FIELD_RATE_X 12         // angular velocity
+#define FIELD_RATE_Y 13
+#define FIELD_RATE_Z 14
+#define FIELD_WARN_LIFTOFF 15   // 0 or 1 flags from here on
+#define FIELD_WARN_RCS 16
+#define FIELD_WARN_ESCAPE 17
+#define FIELD_WARN_CHUTE 18
+#define FIELD_WARN_LANDING 19
+#define FIELD_WARN_FAULT 20
+#define NUM_FIELDS 21
+
+// field masks: bit f stands for field f
+#define FIELD_BIT(f) (1UL << (f))
+#define FIELD_VALUES_M (FIELD_BIT(FIELD_WARN_LIFTOFF) - FIELD_BIT(FIELD_ALTITUDE))
+#define FIELD_FLAGS_M (FIELD_BIT(NUM_FIELDS) - FIELD_BIT(FIELD_WARN_LIFTOFF))
+
+// number of fields in mask
+constexpr uint8_t field_count(const uint32_t mask) {
+  return mask ? (mask & 1) + field_count(mask >> 1) : 0;
+}
+
+// position of field f among the fields of mask
+constexpr uint8_t field_index(const uint32_t mask, const uint8_t f) {
+  return field_count(mask & (FIELD_BIT(f) - 1));
+}
+
+#endif  // FIELDS_H
@@ -0,0 +1,117 @@
+// Compile-time pin descriptors for the ATmega328P. A pin's port,
+// bit and polarity are all resolved from its template parameters,
+// so every operation on a single pin folds down to one sbi/cbi.
+//
+// Pins that drive a device carry its polarity and are only switched
+// with on()/off(); raw high()/low() writes to them do not compile.
+
+#ifndef PINS_H
+#define PINS_H
+
+#include <avr/io.h>
+
+enum class Port : uint8_t { B, C, D };
+
+// which level turns a pin's device on. PLAIN pins have no device
+// behind them and are the only ones that take raw level writes
+enum class Polarity : uint8_t { PLAIN, ACTIVE_HIGH, ACTIVE_LOW };
+
+// port and bit behind an Arduino pin number (D0-7, D8-13, A0-5)
+constexpr Port arduino_port(const uint8_t pin) {
+  return pin < 8 ? Port::D : (pin < 14 ? Port::B : Port::C);
+}
+
+constexpr uint8_t arduino_bit(const uint8_t pin) {
+  return pin < 8 ? pin : (pin < 14 ? pin - 8 : pin - 14);
+}
+
+// registers of each port
+template <Port P> struct PortRegs;
+
+template <> struct PortRegs<Port::B> {
+  static volatile uint8_t &out() { return PORTB; }
+  static volatile uint8_t &ddr() { return DDRB; }
+  static volatile uint8_t &in() { return PINB; }
+};
+
+template <> struct PortRegs<Port::C> {
+  static volatile uint8_t &out() { return PORTC; }
+  static volatile uint8_t &ddr() { return DDRC; }
+  static volatile uint8_t &in() { return PINC; }
+};
+
+template <> struct PortRegs<Port::D> {
+  static volatile uint8_t &out() { return PORTD; }
+  static volatile uint8_t &ddr() { return DDRD; }
+  static volatile uint8_t &in() { return PIND; }
+};
+
+// digital pin N, with its device on at the level given by A
+template <uint8_t N, Polarity A = Polarity::PLAIN>
+struct Pin {
+  static_assert(N < 20, "not an ATmega328P pin");
+
+  typedef PortRegs<arduino_port(N)> Regs;
+  static constexpr Port port = arduino_port(N);
+  static constexpr uint8_t mask = 1 << arduino_bit(N);
+
+  // pin level that puts the device in the given state
+  static constexpr bool level(const bool active) {
+    return active != (A == Polarity::ACTIVE_LOW);
+  }
+
+  // this pin's bit in the image of port p, with the device in the given state
+  static constexpr uint8_t image(const Port p, const bool active) {
+    return (p == port && level(active)) ? mask : 0;
+  }
+
+  // this pin's bit in port p, if it is on p
+  static constexpr uint8_t bits(const Port p) {
+    return p == port ? mask : 0;
+  }
+
+  static void output() { Regs::ddr() |= mask; }
+  static void input() { Regs::ddr() &= ~mask; }
+  static bool read() { return Regs::in() & mask; }
+
+  static void on() {
+    static_assert(A != Polarity::PLAIN, "plain pins have no on state, use high()/low()");
+    if (level(true)) {
+      Regs::out() |= mask;
+    } else {
+      Regs::out() &= ~mask;
+    }
+  }
+
+  static void off() {
+    static_assert(A != Polarity::PLAIN, "plain pins have no off state, use high()/low()");
+    if (level(false)) {
+      Regs::out() |= mask;
+    } else {
+      Regs::out() &= ~mask;
+    }
+  }
+
+  static void high() {
+    static_assert(A == Polarity::PLAIN, "device pins take on()/off(), which apply their polarity");
+    Regs::out() |= mask;
+  }
+
+  static void low() {
+    static_assert(A == Polarity::PLAIN, "device pins take on()/off(), which apply their polarity");
+    Regs::out() &= ~mask;
+  }
+};
+
+// analog input pin N (A0-A5) and its ADC channel
+template <uint8_t N>
+struct AnalogPin : Pin<N> {
+  static_assert(N >= 14 && N < 20, "not an analog pin");
+
+  static constexpr uint8_t channel = N - 14;
+
+  // this pin's bit in DIDR0, which turns off its digital input buffer
+  static constexpr uint8_t didr = 1 << (N - 14);
+};
+
+#endif  // PINS_H
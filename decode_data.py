@@ -0,0 +1,181 @@
+'''
+decodes a binary data file (D<session>.BIN) written by the flight
+controller into CSV
+
+file layout: 512-byte blocks, little endian
+    header (16 bytes, 20 from version 2, 22 from version 3):
+        magic       uint16  0xda7a
+        seq         uint16  block number within the file
+        count       uint8   samples used in this block
+        version     uint8   0: 10-bit readings, 1: 12-bit oversampled,
+                            2: 12-bit with vehicle fields,
+                            3: as 2, with the sample rate,
+                            4: as 3, with the CRC over the used samples
+        blue_sec    uint32  last Blue time when the block was started
+        blue_msec   uint16
+        blue_millis uint32  millis() when that Blue time arrived
+        fields      uint32  version 2: mask of the subscribed packet fields
+        rate        uint16  version 3: samples per second
+    samples (12 bytes each):
+        time        uint32  millis() when taken
+        volt_raw    uint16
+        curr_raw    uint16
+        temp_raw    uint16
+        lab_state   uint16
+    from version 2: a vehicle state per sample, after all the samples:
+        value       int32   each subscribed numeric field in order, in thousandths
+        flags       uint8   bit k: field FIELD_WARN_LIFTOFF + k
+    as many samples as fit, then padding
+    crc             uint16  CRC-16/CCITT over the first 510 bytes, from
+                            version 4 over the header, then the first
+                            count samples and count vehicle states
+
+usage: python3 decode_data.py D0001.BIN [out.csv]
+'''
+
+import binascii
+import os
+import re
+import struct
+import sys
+
+BLOCK_SIZE = 512
+DATA_MAGIC = 0xda7a
+HEADER = struct.Struct('<HHBBIHI')
+FIELDS = struct.Struct('<I')  # version 2 adds the field mask to the header
+RATE = struct.Struct('<H')    # and version 3 the sample rate
+SAMPLE = struct.Struct('<IHHHH')
+FIELDS_H = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'blue_origin_fc', 'fields.h')
+
+# must match the sensor conversions in blue_origin_fc.ino
+V_REF = 1.1
+ADC_MAX = { 0:1023, 1:4092, 2:4092, 3:4092, 4:4092 }  # full scale reading for each block version
+CURR_GAIN_CONSTANT = 68.4
+
+COLUMNS = ['block', 'millis', 'blue_time', 'volt', 'curr', 'temp', 'volt_raw', 'curr_raw', 'temp_raw', 'lab_state']
+
+# column name for every packet field position, from fields.h
+def read_fields(path):
+    with open(path) as f:
+        src = f.read()
+    names = {}
+    for name, pos in re.findall(r'#define FIELD_(\w+) (\d+)', src):
+        names[int(pos)] = name.lower()
+    return names
+
+FIELD_NAMES = read_fields(FIELDS_H)
+FIELD_WARN_FIRST = [pos for pos, name in FIELD_NAMES.items() if name == 'warn_liftoff'][0]
+FIELD_VALUES = range(2, FIELD_WARN_FIRST)                       # numeric vehicle fields
+FIELD_FLAGS = range(FIELD_WARN_FIRST, max(FIELD_NAMES) + 1)     # 0 or 1 flags
+
+# vehicle fields present in a block with field mask fields: the numeric ones,
+# the flags, and the struct of one vehicle state
+def vehicle_layout(fields):
+    values = [f for f in FIELD_VALUES if fields & (1 << f)]
+    flags = [f for f in FIELD_FLAGS if fields & (1 << f)]
+    return values, flags, struct.Struct('<' + 'i' * len(values) + 'B')
+
+def volt_from_raw(raw, adc_max):
+    return V_REF - raw * (V_REF / adc_max)
+
+def curr_from_raw(raw, adc_max):
+    return raw * (V_REF / adc_max) / CURR_GAIN_CONSTANT
+
+def temp_from_raw(raw, adc_max):
+    return raw * (V_REF / adc_max) * 100
+
+# Blue time of a sample taken at millis() t in a block with this header.
+# millis() wraps every ~49 days, so the difference is taken mod 2^32, and
+# signed, as the first samples of a block can predate its Blue time
+def sample_blue_time(header, t):
+    ms = (t - header['blue_millis']) & 0xffffffff
+    if ms >= 0x80000000:
+        ms -= 0x100000000
+    return header['blue_time'] + ms / 1000.0
+
+def bad_block(message):
+    print(message, file=sys.stderr)
+
+# yields (block header, samples) for every used block with a good CRC,
+# and passes what is wrong with the others to error
+def read_blocks(data, error=bad_block):
+    for offset in range(0, len(data) - BLOCK_SIZE + 1, BLOCK_SIZE):
+        block = data[offset:offset + BLOCK_SIZE]
+        magic, seq, count, version, blue_sec, blue_msec, blue_millis = HEADER.unpack_from(block)
+        if magic != DATA_MAGIC:
+            break  # blocks are written in order, the rest are unused
+
+        if version not in ADC_MAX:
+            error("block " + str(seq) + ": unknown version " + str(version) + ", skipped")
+            continue
+
+        header = { 'seq':seq, 'adc_max':ADC_MAX[version], 'blue_time':blue_sec + blue_msec / 1000.0, 'blue_millis':blue_millis,
+                   'fields':0, 'rate':None }
+        start = HEADER.size
+        if version >= 2:
+            header['fields'], = FIELDS.unpack_from(block, start)
+            start += FIELDS.size
+        if version >= 3:
+            header['rate'], = RATE.unpack_from(block, start)
+            start += RATE.size
+        values, flags, vehicle = vehicle_layout(header['fields'])
+        per_block = (BLOCK_SIZE - start - 2) // (SAMPLE.size + (vehicle.size if version >= 2 else 0))
+        n = min(count, per_block)
+        vehicle_start = start + per_block * SAMPLE.size
+
+        crc, = struct.unpack_from('<H', block, BLOCK_SIZE - 2)
+        if version >= 4:
+            covered = (block[:start + n * SAMPLE.size]
+                       + block[vehicle_start:vehicle_start + n * vehicle.size])
+        else:
+            covered = block[:BLOCK_SIZE - 2]
+        if crc != binascii.crc_hqx(covered, 0xffff):
+            error("block " + str(seq) + ": bad crc, skipped")
+            continue
+
+        samples = [SAMPLE.unpack_from(block, start + i * SAMPLE.size) for i in range(n)]
+        if version >= 2:
+            vehicles = [vehicle.unpack_from(block, vehicle_start + i * vehicle.size) for i in range(n)]
+        else:
+            vehicles = [None] * n
+        yield header, list(zip(samples, vehicles))
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: python3 decode_data.py D0001.BIN [out.csv]")
+        return
+
+    with open(sys.argv[1], 'rb') as f:
+        data = f.read()
+
+    blocks = list(read_blocks(data))
+
+    # one column per vehicle field any block has
+    fields = 0
+    for header, samples in blocks:
+        fields |= header['fields']
+    all_values, all_flags, _ = vehicle_layout(fields)
+
+    out = open(sys.argv[2], 'w') if len(sys.argv) > 2 else sys.stdout
+    out.write(','.join(COLUMNS + [FIELD_NAMES[f] for f in all_values + all_flags]) + '\n')
+    for header, samples in blocks:
+        values, flags, _ = vehicle_layout(header['fields'])
+        for (t, volt_raw, curr_raw, temp_raw, lab_state), vehicle in samples:
+            row = [header['seq'], t, "{:.3f}".format(sample_blue_time(header, t)),
+                   "{:.5f}".format(volt_from_raw(volt_raw, header['adc_max'])),
+                   "{:.5f}".format(curr_from_raw(curr_raw, header['adc_max'])),
+                   "{:.3f}".format(temp_from_raw(temp_raw, header['adc_max'])),
+                   volt_raw, curr_raw, temp_raw, "0x{:04x}".format(lab_state)]
+            if vehicle is not None:
+                known = dict(zip(values, vehicle))
+                row += ["{:.3f}".format(known[f] / 1000.0) if f in known else '' for f in all_values]
+                row += [(vehicle[-1] >> (f - FIELD_WARN_FIRST)) & 1 if f in flags else '' for f in all_flags]
+            else:
+                row += [''] * (len(all_values) + len(all_flags))
+            out.write(','.join(str(x) for x in row) + '\n')
+
+    if out is not sys.stdout:
+        out.close()
+
+if __name__ == '__main__':
+    main()
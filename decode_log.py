@@ -0,0 +1,67 @@
+'''
+decodes a binary event log (L<session>.BIN) written by the flight
+controller into text, one event per line
+
+file layout: 11-byte records, little endian, preallocated with 0xff
+bytes. the first record with code 0xff is the end of the log
+    code        uint8   event code, its position in blue_origin_fc/events.h
+    blue_sec    uint32  Blue time the event was logged at
+    blue_msec   uint16
+    lab_state   uint16  lab state when the event was logged
+    count       uint16  only meaningful for counted events
+
+usage: python3 decode_log.py L0001.BIN [out.txt]
+'''
+
+import os
+import re
+import struct
+import sys
+
+RECORD = struct.Struct('<BIHHH')
+ERASED = 0xff
+EVENTS_H = os.path.join(os.path.dirname(os.path.abspath(__file__)), 'blue_origin_fc', 'events.h')
+
+# (text, counted) for every event code, in catalogue order
+def read_events(path):
+    with open(path) as f:
+        src = f.read()
+    return [(text, counted == '1') for name, text, counted
+            in re.findall(r'EVENT\((\w+),\s*"([^"]*)",\s*(\d)\)', src)]
+
+# yields (offset, code, blue_sec, blue_msec, lab_state, count) for every
+# record up to the first erased one
+def read_records(data):
+    # a reset mid-write can leave a partial record at the end
+    for offset in range(0, len(data) - RECORD.size + 1, RECORD.size):
+        record = RECORD.unpack_from(data, offset)
+        if record[0] == ERASED:
+            break
+        yield (offset,) + record
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: python3 decode_log.py L0001.BIN [out.txt]")
+        return
+
+    events = read_events(EVENTS_H)
+    with open(sys.argv[1], 'rb') as f:
+        data = f.read()
+
+    out = open(sys.argv[2], 'w') if len(sys.argv) > 2 else sys.stdout
+    for offset, code, blue_sec, blue_msec, lab_state, count in read_records(data):
+        if code >= len(events):
+            print("offset " + str(offset) + ": unknown event " + str(code), file=sys.stderr)
+            continue
+
+        text, counted = events[code]
+        line = "{}.{:03d} {:x}: {}".format(blue_sec, blue_msec, lab_state, text)
+        if counted:
+            line += ' ' + str(count)
+        out.write(line + '\n')
+
+    if out is not sys.stdout:
+        out.close()
+
+if __name__ == '__main__':
+    main()
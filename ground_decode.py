@@ -0,0 +1,307 @@
+'''
+decodes everything the flight controller leaves behind, for any number
+of flights or simulator runs at once, merges it into one timeline and
+checks it
+
+usage: python3 ground_decode.py [-o DIR] [--jitter-limit MS] PATH [PATH ...]
+    PATH is a card dump or nanolab_sim output directory, or single
+    L<nnnn>.BIN / D<nnnn>.BIN files. every session found is decoded:
+    its events (L), samples and vehicle fields (D), and with them the
+    source's checkpoints (state.bin, and eeprom.bin from the simulator
+    or an EEPROM dump) and PROFILE build stats (prof.txt)
+
+writes to DIR (default ground_out):
+    timeline.csv  one row per sample or event, every session, in Blue
+                  time order within each session. events before the
+                  first packet after a boot carry the last Blue time
+                  known
+    prof.csv      the profiler sections and phases, if any source has them
+
+prints a report, and exits 1 if a check failed:
+    data blocks with a bad CRC, unknown event codes, and sample
+    intervals more than the jitter limit off a whole number of sample
+    periods. the period is the rate in each block's header, or the
+    sketch's SAMPLE_RATE_HZ for blocks older than version 3. checkpoint slots are listed with their CRC state, and
+    samples missing from the intervals are counted, as ADAPTIVE_LOG
+    builds leave them out on purpose
+'''
+
+import argparse
+import binascii
+import csv
+import glob
+import mmap
+import os
+import re
+import struct
+import sys
+
+import decode_data
+import decode_log
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SKETCH = os.path.join(HERE, 'blue_origin_fc', 'blue_origin_fc.ino')
+
+# must match Checkpoint and the checkpoint slot layout in blue_origin_fc.ino
+CHECKPOINT = struct.Struct('<HHIHIHIHHccHH')
+MAGIC_NUMBER = 0x451b
+STATE_SLOTS, STATE_SLOT_SIZE = 2, 512
+EEPROM_SLOTS, EEPROM_SLOT_SIZE = 32, 32
+
+SESSION_FILE = re.compile(r'^([LD])(\d{4})\.BIN$')
+DEFAULT_JITTER_LIMIT = 2.0  # ms, millis() alone can be a tick off either way
+
+TIMELINE = ['source', 'session', 'blue_time', 'kind', 'millis', 'lab_state', 'event', 'count',
+            'block', 'volt', 'curr', 'temp', 'volt_raw', 'curr_raw', 'temp_raw']
+PROF = ['source', 'report', 'section', 'count', 'min_us', 'mean_us', 'max_us']
+
+
+def read_defines(path):
+    with open(path) as f:
+        return {name: int(value) for name, value in re.findall(r'#define (\w+) (\d+)\b', f.read())}
+
+
+def map_file(path):
+    '''
+    the whole file as a read-only buffer, mapped rather than read so
+    that multi-MB data files cost nothing until they are decoded
+    '''
+    with open(path, 'rb') as f:
+        if os.fstat(f.fileno()).st_size == 0:
+            return b''
+        return mmap.mmap(f.fileno(), 0, access=mmap.ACCESS_READ)
+
+
+def find_sessions(paths):
+    '''
+    returns {(source dir, session): {'L': path, 'D': path}} for every
+    session file under paths, and the set of source dirs
+    '''
+    sessions = {}
+    sources = set()
+    for path in paths:
+        files = sorted(glob.glob(os.path.join(path, '*'))) if os.path.isdir(path) else [path]
+        source = path if os.path.isdir(path) else os.path.dirname(path) or '.'
+        sources.add(source)
+        for name in files:
+            m = SESSION_FILE.match(os.path.basename(name))
+            if m:
+                sessions.setdefault((source, int(m.group(2))), {})[m.group(1)] = name
+    return sessions, sources
+
+
+def read_checkpoints(path, slots, slot_size):
+    '''
+    yields (slot, state, checkpoint dict or None) for every slot of a
+    checkpoint image. state is 'ok', 'bad crc' or 'empty'
+    '''
+    data = map_file(path)
+    for slot in range(slots):
+        raw = data[slot * slot_size:slot * slot_size + CHECKPOINT.size]
+        if len(raw) < CHECKPOINT.size:
+            yield slot, 'empty', None
+            continue
+        (magic, seq, last_sec, last_msec, phase_sec, phase_msec, step_sec, step_msec,
+         lab_state, blue_state, last_blue_state, session, crc) = CHECKPOINT.unpack(raw)
+        if magic != MAGIC_NUMBER:
+            yield slot, 'empty', None
+        elif crc != binascii.crc_hqx(raw[:-2], 0xffff):
+            yield slot, 'bad crc', None
+        else:
+            yield slot, 'ok', {'seq': seq, 'session': session, 'lab_state': lab_state,
+                               'blue_state': blue_state.decode('latin-1'),
+                               'blue_time': last_sec + last_msec / 1000.0}
+
+
+def check_checkpoints(source, report):
+    for name, slots, slot_size in [('state.bin', STATE_SLOTS, STATE_SLOT_SIZE),
+                                   ('eeprom.bin', EEPROM_SLOTS, EEPROM_SLOT_SIZE)]:
+        path = os.path.join(source, name)
+        if not os.path.exists(path):
+            continue
+        counts = {'ok': 0, 'bad crc': 0, 'empty': 0}
+        newest = None
+        for slot, state, cp in read_checkpoints(path, slots, slot_size):
+            counts[state] += 1
+            # sequence numbers wrap, so compare by difference
+            if cp and (newest is None or ((cp['seq'] - newest['seq']) & 0xffff) < 0x8000):
+                newest = cp
+        line = "  {}: {} ok, {} bad crc, {} empty".format(name, counts['ok'], counts['bad crc'], counts['empty'])
+        if newest:
+            line += "; newest seq {} session {} phase {} lab state {:x} at {:.3f}".format(
+                newest['seq'], newest['session'], newest['blue_state'], newest['lab_state'], newest['blue_time'])
+        report.append(line)
+
+
+def decode_events(path, events, problems):
+    '''
+    returns timeline rows for the session's log, with Blue time carried
+    over the events logged before a boot's first packet
+    '''
+    rows = []
+    last_time = 0.0
+    for offset, code, blue_sec, blue_msec, lab_state, count in decode_log.read_records(map_file(path)):
+        if code >= len(events):
+            problems.append("{}: offset {}: unknown event {}".format(path, offset, code))
+            continue
+        text, counted = events[code]
+        t = blue_sec + blue_msec / 1000.0
+        last_time = t if t > 0 else last_time
+        rows.append({'blue_time': last_time, 'kind': 'event', 'lab_state': "0x{:04x}".format(lab_state),
+                     'event': text, 'count': count if counted else ''})
+    return rows
+
+
+def decode_samples(path, problems, default_rate):
+    '''
+    returns timeline rows for the session's samples, the vehicle field
+    columns they fill, and the sample times and periods (ms) in file
+    order. blocks that don't record their rate were taken at default_rate
+    '''
+    blocks = list(decode_data.read_blocks(map_file(path), lambda message: problems.append(path + ": " + message)))
+    fields = 0
+    for header, samples in blocks:
+        fields |= header['fields']
+    all_values, all_flags, _ = decode_data.vehicle_layout(fields)
+    columns = [decode_data.FIELD_NAMES[f] for f in all_values + all_flags]
+
+    rows = []
+    times = []
+    periods = []
+    for header, samples in blocks:
+        values, flags, _ = decode_data.vehicle_layout(header['fields'])
+        adc_max = header['adc_max']
+        period = 1000.0 / (header['rate'] or default_rate)
+        for (t, volt_raw, curr_raw, temp_raw, lab_state), vehicle in samples:
+            row = {'blue_time': decode_data.sample_blue_time(header, t), 'kind': 'sample', 'millis': t,
+                   'lab_state': "0x{:04x}".format(lab_state), 'block': header['seq'],
+                   'volt': "{:.5f}".format(decode_data.volt_from_raw(volt_raw, adc_max)),
+                   'curr': "{:.5f}".format(decode_data.curr_from_raw(curr_raw, adc_max)),
+                   'temp': "{:.3f}".format(decode_data.temp_from_raw(temp_raw, adc_max)),
+                   'volt_raw': volt_raw, 'curr_raw': curr_raw, 'temp_raw': temp_raw}
+            if vehicle is not None:
+                for f, v in zip(values, vehicle):
+                    row[decode_data.FIELD_NAMES[f]] = "{:.3f}".format(v / 1000.0)
+                for f in flags:
+                    row[decode_data.FIELD_NAMES[f]] = (vehicle[-1] >> (f - decode_data.FIELD_WARN_FIRST)) & 1
+            rows.append(row)
+            times.append(t)
+            periods.append(period)
+    return rows, columns, times, periods
+
+
+def check_jitter(times, periods, limit):
+    '''
+    measures each interval between samples against the nearest whole
+    number of the later sample's period. a reset restarts millis(), so an interval
+    that goes backwards starts a new run. returns (intervals, worst
+    jitter ms, intervals over limit, samples missing)
+    '''
+    intervals = 0
+    worst = 0.0
+    over = 0
+    missing = 0
+    for a, b, period in zip(times, times[1:], periods[1:]):
+        d = (b - a) & 0xffffffff
+        if d == 0 or d >= 0x80000000:
+            continue
+        k = max(1, int(round(d / period)))
+        jitter = abs(d - k * period)
+        intervals += 1
+        missing += k - 1
+        worst = max(worst, jitter)
+        over += jitter > limit
+    return intervals, worst, over, missing
+
+
+def read_prof(source):
+    '''
+    returns prof.csv rows for a source's prof.txt. each report starts
+    over at the first section; phase lines have a single letter
+    '''
+    path = os.path.join(source, 'prof.txt')
+    rows = []
+    if not os.path.exists(path):
+        return rows
+    report = 0
+    with open(path) as f:
+        for line in f:
+            words = line.split()
+            if not words:
+                continue
+            if words[0] == 'serial':
+                report += 1
+            if len(words[0]) == 1 and len(words) == 4:
+                rows.append([source, report, 'phase ' + words[0], words[1], '', words[2], words[3]])
+            elif len(words) >= 5:
+                rows.append([source, report] + words[:5])
+    return rows
+
+
+def main():
+    parser = argparse.ArgumentParser(description="flight log batch decoder")
+    parser.add_argument('paths', nargs='+', help="card dump or nanolab_sim output directories, or session files")
+    parser.add_argument('-o', dest='out', default='ground_out', help="output directory")
+    parser.add_argument('--jitter-limit', type=float, default=DEFAULT_JITTER_LIMIT,
+                        help="ms a sample interval may be off a whole number of periods")
+    args = parser.parse_args()
+
+    events = decode_log.read_events(decode_log.EVENTS_H)
+    default_rate = read_defines(SKETCH)['SAMPLE_RATE_HZ']
+    sessions, sources = find_sessions(args.paths)
+    if not sessions:
+        raise SystemExit("no session files (L<nnnn>.BIN, D<nnnn>.BIN) found")
+
+    problems = []
+    report = []
+    timeline = []
+    field_columns = []
+    for source in sorted(sources):
+        report.append(source)
+        check_checkpoints(source, report)
+        for (src, number), files in sorted(sessions.items()):
+            if src != source:
+                continue
+            rows = decode_events(files['L'], events, problems) if 'L' in files else []
+            line = "  session {}: {} events".format(number, len(rows))
+            if 'D' in files:
+                samples, columns, times, periods = decode_samples(files['D'], problems, default_rate)
+                field_columns += [c for c in columns if c not in field_columns]
+                intervals, worst, over, missing = check_jitter(times, periods, args.jitter_limit)
+                line += ", {} samples, worst jitter {:.1f} ms, {} intervals over {} ms, {} samples missing".format(
+                    len(samples), worst, over, args.jitter_limit, missing)
+                if over:
+                    problems.append("{} session {}: {} sample intervals over the jitter limit".format(source, number, over))
+                rows += samples
+            report.append(line)
+
+            # events come first at a tie: they were logged before the samples taken after them were written
+            rows.sort(key=lambda row: (row['blue_time'], row['kind'] == 'sample'))
+            for row in rows:
+                row['source'] = source
+                row['session'] = number
+                row['blue_time'] = "{:.3f}".format(row['blue_time'])
+            timeline += rows
+
+    if not os.path.isdir(args.out):
+        os.makedirs(args.out)
+    with open(os.path.join(args.out, 'timeline.csv'), 'w', newline='') as f:
+        writer = csv.DictWriter(f, TIMELINE + field_columns, restval='')
+        writer.writeheader()
+        writer.writerows(timeline)
+    prof = [row for source in sorted(sources) for row in read_prof(source)]
+    if prof:
+        with open(os.path.join(args.out, 'prof.csv'), 'w', newline='') as f:
+            writer = csv.writer(f)
+            writer.writerow(PROF)
+            writer.writerows(prof)
+
+    print('\n'.join(report))
+    print("{} rows written to {}".format(len(timeline), os.path.join(args.out, 'timeline.csv')))
+    for problem in problems:
+        print("FAIL " + problem)
+    if problems:
+        sys.exit(1)
+
+if __name__ == '__main__':
+    main()
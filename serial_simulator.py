@@ -1,64 +1,250 @@
-'''
-115200 baud
-frame:
-    8 data bits
-    0 parity bits
-    1 stop bit
-    (8N1)
-ASCII data, 21 fields, separated by commas
-'''
-
-import threading
-import time
-import serial
-import serial.tools.list_ports
-
-PHASES = ['@', 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J']  # NOTE: state 'J' means that the simulation is over (won't happend IRL)
-PHASE_DESC = { '@':"No flight state reached", 'A':"Liftoff", 'B':"Meco", 'C':"Separation", 'D':"Coast_Start", 'E':"Apogee", 'F':"Coast_End", 'G':"Under_Chutes", 'H':"Landing", 'I':"Safing", 'J':"Simulation Finished"}
-TICKS_PER_PHASE = { '@':10, 'A':10, 'B':10, 'C':10, 'D':10, 'E':10, 'F':10, 'G':10, 'H':10, 'I':10, 'J':10}
-DATA_FREQUENCY = 0.1  # time between data bursts (in s)
-
-def main():
-    devices = serial.tools.list_ports.comports()
-    device = None
-    if len(devices) > 0:
-        i = 0
-        while i < len(devices) and "ttyACM0" not in devices[i].description:
-            print(type(devices[i]))
-            i += 1
-        if i == len(devices):
-            print("No Arduino connected")
-            return
-
-        device = devices[i]
-
-        try:
-            ser = serial.Serial(port=device.device, baudrate=115200, bytesize=serial.EIGHTBITS, parity=serial.PARITY_NONE, stopbits=serial.STOPBITS_ONE,
-                                timeout=0)  # setting this timeout allows for write to be non-blocking
-        except serial.SerialException:
-            print("error connecting to " + device.description + ", perhaps it is already in use?")
-            return
-        print("transmitting to " + device.description)
-
-        # tick
-        startTime = time.time()
-
-        for phase in PHASES:
-            print("[" + phase + "] " + PHASE_DESC[phase])
-            for i in range(TICKS_PER_PHASE[phase]):
-                # TODO: replace these with numbers that change
-                dataString = phase + "," + "{:.2f}".format(time.time()) + ",9697.791016,-216.117355,0.239193,-0.373560,32.779297,0.000000,0.000000,-0.272123,-0.004113,0.000209,-0.001000,0.000000,0.000000,0,0,0,1,0,0"
-                ser.write(dataString.encode("ASCII"))
-                # print(dataString.encode("ASCII"))
-                time.sleep(DATA_FREQUENCY)
-        
-        # tock
-        endTime = time.time()
-        
-        print(str(endTime - startTime) + " seconds elapsed")
-        ser.close()
-
-    else:
-        print("no serial devices found")
-
-main()
+'''
+115200 baud
+frame:
+    8 data bits
+    0 parity bits
+    1 stop bit
+    (8N1)
+ASCII data, 21 fields, separated by commas
+
+plays a mission profile to the flight controller, or writes the
+timed packet stream to a file for the host simulator (sim/)
+
+usage: python3 serial_simulator.py [profile] [--port DEV] [--speed X]
+                                   [--seed N] [--record FILE] [--write FILE]
+
+a profile has one line per phase, # starts a comment:
+    <phase> <seconds> [period ms] [option=value ...]
+options:
+    jitter=MS     move each packet up to MS earlier or later
+    burst=N       send N packets back to back on every tick
+    corrupt=P     damage each packet with probability P
+    drop=P        skip each packet with probability P
+    accel=A       send an x acceleration of A m/s^2 (default as on ascent)
+a phase of - is a dropout: nothing is sent for that many seconds.
+with no profile every phase is sent for one second.
+
+--speed divides every gap in the stream by X. Blue time in the packets
+still follows the profile, but the controller's own timers do not
+speed up, so use it to stress the parser and the scheduler rather
+than to fly a mission. --record saves what was sent and everything
+the controller printed back, with times, to FILE.
+'''
+
+import argparse
+import random
+import threading
+import time
+
+# these match the BS_* defines in blue_origin_fc.ino
+PHASES = ['@', 'A', 'B', 'C', 'D', 'E', 'F', 'G', 'H', 'I', 'J', 'K', 'L', 'M']
+PHASE_DESC = { '@':"No flight state reached", 'A':"Abort_Enabled", 'B':"Abort_Commanded", 'C':"Liftoff", 'D':"Meco",
+               'E':"Separation_Commanded", 'F':"Coast_Start", 'G':"Apogee", 'H':"Coast_End", 'I':"Drogue_Deploy",
+               'J':"Main_Chute_Deploy", 'K':"Landing", 'L':"Safing", 'M':"Mission_End", '-':"Dropout"}
+DROPOUT = '-'
+DEFAULT_PERIOD = 100  # time between data bursts (in ms)
+BLUE_EPOCH = 1600000000  # Blue time at the start of the profile (in s)
+# the 19 fields after phase and time, with the x acceleration left open
+PAYLOAD = ",9697.791016,-216.117355,0.239193,-0.373560,{:.6f},0.000000,0.000000,-0.272123,-0.004113,0.000209,-0.001000,0.000000,0.000000,0,0,0,1,0,0"
+DEFAULT_ACCEL = 32.779297
+PRINTABLE = "0123456789.,-@ABCDEFGHIJKLMxyz "
+
+
+def parse_profile(path):
+    '''
+    returns a list of segments, one per profile line:
+    (phase, seconds, period ms, options dict)
+    '''
+    segments = []
+    with open(path) as f:
+        for n, line in enumerate(f, 1):
+            words = line.split('#')[0].split()
+            if not words:
+                continue
+            try:
+                phase, seconds = words[0], float(words[1])
+                period = DEFAULT_PERIOD
+                options = {}
+                for word in words[2:]:
+                    if '=' in word:
+                        key, value = word.split('=', 1)
+                        options[key] = float(value)
+                    else:
+                        period = float(word)
+            except (IndexError, ValueError):
+                raise SystemExit(path + ":" + str(n) + ": expected <phase> <seconds> [period ms] [option=value ...]")
+            if phase not in PHASE_DESC or period <= 0:
+                raise SystemExit(path + ":" + str(n) + ": bad phase or period")
+            segments.append((phase, seconds, period, options))
+    return segments
+
+
+def default_profile():
+    return [(phase, 1.0, DEFAULT_PERIOD, {}) for phase in PHASES]
+
+
+def corrupt(packet, rng):
+    '''
+    damages a packet the ways a noisy line does: a changed or lost
+    character, a stray control byte, or a packet cut short
+    '''
+    kind = rng.randrange(4)
+    i = rng.randrange(1, len(packet))
+    if kind == 0:
+        return packet[:i] + rng.choice(PRINTABLE) + packet[i + 1:]
+    if kind == 1:
+        return packet[:i] + packet[i + 1:]
+    if kind == 2:
+        return packet[:i] + chr(rng.randrange(0x01, 0x20)) + packet[i:]
+    return packet[:i]
+
+
+def build_stream(segments, rng):
+    '''
+    turns a profile into a list of (send time s, phase, packet), in
+    profile time and in send order.
+    '''
+    stream = []
+    t = 0.0
+    for phase, seconds, period, options in segments:
+        end = t + seconds
+        if phase == DROPOUT:
+            t = end
+            continue
+
+        jitter = options.get('jitter', 0) / 1000
+        burst = int(options.get('burst', 1))
+        payload = PAYLOAD.format(options.get('accel', DEFAULT_ACCEL))
+        for tick in range(int(round(seconds * 1000 / period))):
+            tick_time = t + tick * period / 1000
+            blue_time = "{:.2f}".format(BLUE_EPOCH + tick_time)
+            send_time = max(tick_time + rng.uniform(-jitter, jitter), stream[-1][0] if stream else 0)
+            for _ in range(burst):
+                if rng.random() < options.get('drop', 0):
+                    continue
+                packet = phase + "," + blue_time + payload
+                if rng.random() < options.get('corrupt', 0):
+                    packet = corrupt(packet, rng)
+                stream.append((send_time, phase, packet))
+        t = end
+    return stream
+
+
+def write_stream(stream, path, speed):
+    '''
+    writes "<send time ms> <packet>" lines, as nanolab_sim --stream
+    reads them. bytes outside printable ASCII and \\ are escaped as \\xNN
+    '''
+    with open(path, "w") as f:
+        for send_time, phase, packet in stream:
+            text = "".join(c if ' ' <= c <= '~' and c != '\\' else "\\x{:02x}".format(ord(c)) for c in packet)
+            f.write("{:.3f} {}\n".format(send_time / speed * 1000, text))
+
+
+def open_port(name):
+    import serial
+    import serial.tools.list_ports
+
+    if name is None:
+        devices = serial.tools.list_ports.comports()
+        i = 0
+        while i < len(devices) and "ttyACM0" not in devices[i].description:
+            i += 1
+        if i == len(devices):
+            print("No Arduino connected")
+            return None
+        name = devices[i].device
+
+    try:
+        ser = serial.Serial(port=name, baudrate=115200, bytesize=serial.EIGHTBITS, parity=serial.PARITY_NONE, stopbits=serial.STOPBITS_ONE,
+                            timeout=0.05)  # short read timeout so the reader thread can notice the end of the run
+    except serial.SerialException:
+        print("error connecting to " + name + ", perhaps it is already in use?")
+        return None
+    print("transmitting to " + name)
+    return ser
+
+
+def read_responses(ser, start_time, events, lock, done):
+    '''
+    records every line the controller prints, with the time it arrived
+    '''
+    line = b""
+    while not done.is_set():
+        data = ser.read(64)
+        now = time.time() - start_time
+        for b in data:
+            if b == ord('\n'):
+                with lock:
+                    events.append((now, "rx", line.decode("ASCII", "replace").rstrip('\r')))
+                line = b""
+            else:
+                line += bytes([b])
+
+
+def play(stream, ser, speed, record):
+    events = []
+    lock = threading.Lock()
+    done = threading.Event()
+
+    # tick
+    startTime = time.time()
+
+    reader = threading.Thread(target=read_responses, args=(ser, startTime, events, lock, done))
+    reader.start()
+
+    last_phase = None
+    for send_time, phase, packet in stream:
+        delay = startTime + send_time / speed - time.time()
+        if delay > 0:
+            time.sleep(delay)
+        if phase != last_phase:
+            print("[" + phase + "] " + PHASE_DESC[phase])
+            last_phase = phase
+        ser.write(packet.encode("latin-1"))
+        with lock:
+            events.append((time.time() - startTime, "tx", packet))
+
+    time.sleep(0.5)  # let the last responses arrive
+    done.set()
+    reader.join()
+
+    # tock
+    endTime = time.time()
+
+    print(str(endTime - startTime) + " seconds elapsed")
+    ser.close()
+
+    if record:
+        with open(record, "w") as f:
+            for t, direction, text in sorted(events, key=lambda e: e[0]):
+                f.write("{:.6f} {} {}\n".format(t, direction, text))
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Blue packet stream generator")
+    parser.add_argument("profile", nargs="?", help="mission profile, see the top of this file")
+    parser.add_argument("--port", help="serial device (default: the first ttyACM0)")
+    parser.add_argument("--speed", type=float, default=1.0, help="time compression factor")
+    parser.add_argument("--seed", type=int, default=0, help="seed for jitter, drops and corruption")
+    parser.add_argument("--record", help="file to save sent packets and responses to")
+    parser.add_argument("--write", help="write the stream to this file instead of a port")
+    args = parser.parse_args()
+
+    if args.speed <= 0:
+        raise SystemExit("--speed must be positive")
+
+    segments = parse_profile(args.profile) if args.profile else default_profile()
+    stream = build_stream(segments, random.Random(args.seed))
+
+    if args.write:
+        write_stream(stream, args.write, args.speed)
+        print(str(len(stream)) + " packets written to " + args.write)
+        return
+
+    ser = open_port(args.port)
+    if ser is None:
+        return
+    play(stream, ser, args.speed, args.record)
+
+main()
@@ -0,0 +1,179 @@
+'''
+benchmarks the serial-to-actuator path on the host build, against a
+few card timing models, and compares the results with a baseline
+
+latency: time from the stop bit of the last byte of the first packet
+    carrying a phase to the edge the phase causes, less the delay the
+    sketch means to add (FRAME_GAP_TIME, and e.g. PRIME_WAIT_TIME). in
+    ms. what is left is the wait for the next millis() tick, card
+    stalls on the path, and the sketch's CPU time
+rate: the highest packet rate, in packets/s, with no bytes lost to
+    a full receive buffer (EV_RX_DROPPED) while plating is writing
+    samples to the card, at this and every slower period tried
+
+the simulator charges CPU time only at the SIM_CYCLES_* estimates in
+hal.h: per interrupt, per byte read and parsed, and per loop() pass.
+the rest of the sketch runs in no time, so the bench catches card
+stalls and changes to the receive path's timing, not slow task code
+
+usage: python3 bench.py [--update] [--baseline FILE]
+    --update writes the results as the new baseline
+'''
+
+import argparse
+import glob
+import os
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+SIM = os.path.join(HERE, 'build', 'nanolab_sim')
+SKETCH = os.path.join(HERE, '..', 'blue_origin_fc', 'blue_origin_fc.ino')
+EVENTS_H = os.path.join(HERE, '..', 'blue_origin_fc', 'events.h')
+BASELINE = os.path.join(HERE, 'bench_baseline.txt')
+RECORD = struct.Struct('<BIHHH')  # as in decode_log.py
+ERASED = 0xff
+
+# name, us busy per sector read or written, us busy per flush or close
+CARDS = [('ideal', 0, 0), ('typical', 500, 5000), ('slow', 2000, 25000)]
+
+# phase, device, level, the delay the sketch adds on purpose
+EDGES = [
+    ('E', 'MOTOR', 0, 'FRAME_GAP_TIME + PRIME_WAIT_TIME'),
+    ('E', 'MOTOR', 1, 'FRAME_GAP_TIME + PRIME_WAIT_TIME + PRIME_TIME'),
+    ('F', 'EXPERIMENT', 0, 'FRAME_GAP_TIME'),
+    ('H', 'EXPERIMENT', 1, 'FRAME_GAP_TIME'),
+    ('K', 'PUMP_POWER', 0, 'FRAME_GAP_TIME'),
+    ('K', 'SOL_3', 0, 'FRAME_GAP_TIME'),
+]
+LATENCY_PROFILE = "@ 5\nC 5\nD 2\nE 5\nF 5\nH 3\nK 8\nM 2\n"
+
+# packet periods tried for the rate, slowest first, in ms. 13 is
+# about back to back
+PERIODS = range(100, 12, -1)
+RATE_SECONDS = 20
+
+LATENCY_SLACK = 0.05  # ms a latency may grow before it is a regression
+
+
+def read_defines(path):
+    with open(path) as f:
+        return {name: int(value) for name, value in re.findall(r'#define (\w+) (\d+)\b', f.read())}
+
+
+def read_events(path):
+    with open(path) as f:
+        return re.findall(r'EVENT\((\w+),\s*"[^"]*",\s*\d\)', f.read())
+
+
+def run(profile, card, out):
+    with tempfile.NamedTemporaryFile('w', suffix='.txt', delete=False) as f:
+        f.write(profile)
+    try:
+        result = subprocess.run([SIM, '-o', out, '--sd-latency', str(card[1]) + ',' + str(card[2]), f.name],
+                                stdout=subprocess.PIPE, stderr=subprocess.DEVNULL, universal_newlines=True, check=True)
+    finally:
+        os.remove(f.name)
+    return result.stdout.splitlines()
+
+
+def latencies(card, defines, workdir):
+    trace = run(LATENCY_PROFILE, card, os.path.join(workdir, 'latency_' + card[0]))
+    phases = {}
+    edges = []
+    for line in trace:
+        words = line.split()
+        if words[1] == 'phase':
+            phases.setdefault(words[2], float(words[0]))
+        elif len(words) == 4:
+            edges.append((float(words[0]), words[2], int(words[3])))
+
+    results = {}
+    for phase, device, level, delay in EDGES:
+        key = 'latency ' + card[0] + ' ' + phase + ' ' + device + ' ' + str(level)
+        start = phases.get(phase)
+        hit = [t for t, d, l in edges if d == device and l == level and start is not None and t >= start]
+        if hit:
+            results[key] = (hit[0] - start) * 1000 - eval(delay, {}, defines)
+        else:
+            results[key] = float('inf')
+    return results
+
+
+def rx_dropped(path, events):
+    code = events.index('EV_RX_DROPPED')
+    total = 0
+    with open(path, 'rb') as f:
+        data = f.read()
+    for offset in range(0, len(data) - RECORD.size + 1, RECORD.size):
+        c, blue_sec, blue_msec, lab_state, count = RECORD.unpack_from(data, offset)
+        if c == ERASED:
+            break
+        if c == code:
+            total += count
+    return total
+
+
+def max_rate(card, events, workdir):
+    best = 0.0
+    for period in PERIODS:
+        out = os.path.join(workdir, 'rate_' + card[0] + '_' + str(period))
+        # quiet while the sketch boots, as on the vehicle, then through
+        # priming into plating, so the card is busy with samples
+        trace = run("- 5\n@ 1 {0}\nC 1 {0}\nE 5 {0}\nF {1} {0}\n".format(period, RATE_SECONDS), card, out)
+        if not any(line.endswith(' EXPERIMENT 0') for line in trace):
+            raise SystemExit("rate run at " + str(period) + " ms never started plating")
+        if rx_dropped(sorted(glob.glob(os.path.join(out, 'L*.BIN')))[-1], events) > 0:
+            break
+        best = 1000.0 / period
+    return {'rate ' + card[0]: best}
+
+
+def read_baseline(path):
+    baseline = {}
+    with open(path) as f:
+        for line in f:
+            words = line.split()
+            if words:
+                baseline[' '.join(words[:-1])] = float(words[-1])
+    return baseline
+
+
+def main():
+    parser = argparse.ArgumentParser(description="serial-to-actuator benchmark")
+    parser.add_argument('--update', action='store_true', help="save the results as the baseline")
+    parser.add_argument('--baseline', default=BASELINE)
+    args = parser.parse_args()
+
+    defines = read_defines(SKETCH)
+    events = read_events(EVENTS_H)
+    results = {}
+    with tempfile.TemporaryDirectory() as workdir:
+        for card in CARDS:
+            results.update(latencies(card, defines, workdir))
+            results.update(max_rate(card, events, workdir))
+
+    baseline = read_baseline(args.baseline) if os.path.exists(args.baseline) and not args.update else {}
+    regressions = 0
+    for key, value in results.items():
+        line = "{:40} {:8.3f}".format(key, value)
+        if key in baseline:
+            old = baseline[key]
+            worse = value > old + LATENCY_SLACK if key.startswith('latency') else value < old
+            line += "  (baseline {:8.3f}){}".format(old, "  REGRESSION" if worse else "")
+            regressions += worse
+        print(line)
+
+    if args.update:
+        with open(args.baseline, 'w') as f:
+            for key, value in results.items():
+                f.write("{} {:.3f}\n".format(key, value))
+        print("baseline written to " + args.baseline)
+    elif regressions:
+        print(str(regressions) + " regressions")
+        sys.exit(1)
+
+main()
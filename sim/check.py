@@ -0,0 +1,170 @@
+'''
+regression checks on the host build. each check flies one or more
+missions through nanolab_sim and looks at the actuator trace and the
+files left on the card
+
+usage: python3 check.py [NAME ...]
+    runs the named checks, or all of them. exits 1 if any fails
+'''
+
+import os
+import subprocess
+import sys
+import tempfile
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+sys.path.insert(0, os.path.join(HERE, '..'))
+
+import decode_log
+
+SIM = os.path.join(HERE, 'build', 'nanolab_sim')
+NOMINAL = os.path.join(HERE, 'profiles', 'nominal.txt')
+SLOW_CARD = ['--sd-latency', '2000,25000']    # as bench.py's slow card
+
+# quiet while the sketch boots, then the whole mission in brief
+SHORT_MISSION = "- 5\n@ 5\nC 5\nE 5\nF 5\nH 2\nK 8\nL 2\nM 2\n"
+
+
+def run(profile, out, options=()):
+    '''
+    flies profile into out and returns the trace lines
+    '''
+    with tempfile.NamedTemporaryFile('w', suffix='.txt', delete=False) as f:
+        f.write(profile)
+    try:
+        result = subprocess.run([SIM, '-o', out] + list(options) + [f.name], stdout=subprocess.PIPE,
+                                stderr=subprocess.DEVNULL, universal_newlines=True, check=True)
+    finally:
+        os.remove(f.name)
+    return result.stdout.splitlines()
+
+
+def events(path):
+    '''
+    returns the (text, count) of every event in a session's log
+    '''
+    names = decode_log.read_events(decode_log.EVENTS_H)
+    with open(path, 'rb') as f:
+        return [(names[code][0], count) for offset, code, sec, msec, lab_state, count
+                in decode_log.read_records(f.read())]
+
+
+def edges(trace, device):
+    return [int(line.split()[3]) for line in trace if len(line.split()) == 4 and line.split()[2] == device]
+
+
+def check_two_missions(workdir, fail):
+    '''
+    a mission that ends normally leaves no checkpoint behind, so the
+    next power up on the same card and EEPROM flies a whole new mission
+    '''
+    out = os.path.join(workdir, 'two_missions')
+    for session in (1, 2):
+        trace = run(SHORT_MISSION, out)
+        log = os.path.join(out, 'L{:04d}.BIN'.format(session))
+        if not os.path.exists(log):
+            fail("mission {} wrote no {}".format(session, os.path.basename(log)))
+            return
+        texts = [text for text, count in events(log)]
+        if 'cold' not in texts or 'hot' in texts:
+            fail("mission {} did not boot cold".format(session))
+        if edges(trace, 'MOTOR')[-2:] != [0, 1] or edges(trace, 'EXPERIMENT')[-2:] != [0, 1]:
+            fail("mission {} did not prime and plate".format(session))
+        if not os.path.exists(os.path.join(out, 'D{:04d}.BIN'.format(session))):
+            fail("mission {} wrote no data file".format(session))
+
+
+def check_slow_card(workdir, fail):
+    '''
+    a nominal flight on a slow card loses no serial bytes: card work
+    waits for the gaps between packets and never holds up the lab
+    '''
+    out = os.path.join(workdir, 'slow_card')
+    with open(NOMINAL) as f:
+        profile = "- 10\n" + f.read()     # the stream starts once the card is laid out
+    run(profile, out, SLOW_CARD)
+    dropped = sum(count for text, count in events(os.path.join(out, 'L0001.BIN')) if text == 'rx dropped')
+    if dropped:
+        fail("{} overflows of the receive buffer".format(dropped))
+
+
+def check_late_card(workdir, fail):
+    '''
+    a card that goes in mid-flight still gets the session record, with
+    everything that happened before it queued ahead of it
+    '''
+    out = os.path.join(workdir, 'late_card')
+    with open(NOMINAL) as f:
+        run(f.read(), out, ['--sd-insert', '300000'])
+    texts = [text for text, count in events(os.path.join(out, 'L0001.BIN'))]
+    if 'session' not in texts:
+        fail("no session record")
+    if 'log dropped' in texts:
+        fail("log events lost to a full ring")
+
+
+def check_early_reset(workdir, fail):
+    '''
+    a reset after sep commanded, while the lab waits to prime, comes
+    back hot with the step time still unset. the prime still starts a
+    second into the phase and runs its full three seconds
+    '''
+    out = os.path.join(workdir, 'early_reset')
+    run(SHORT_MISSION, out, ['--until', '15500'])
+    trace = run(SHORT_MISSION, out, ['--from', '15500'])
+    texts = [text for text, count in events(os.path.join(out, 'L0001.BIN'))]
+    if 'hot' not in texts:
+        fail("the reset did not come back hot")
+    # past the 15.5 s boot, where every output is set up
+    motor = [(float(line.split()[0]), line.split()[3]) for line in trace
+             if len(line.split()) == 4 and line.split()[2] == 'MOTOR' and float(line.split()[0]) > 15.5]
+    if [level for t, level in motor] != ['0', '1'] or abs(motor[0][0] - 16.0) > 0.1 or \
+            abs(motor[1][0] - motor[0][0] - 3.0) > 0.1:
+        fail("prime ran {} instead of 16 s to 19 s".format(motor))
+
+
+def check_dead_card(workdir, fail):
+    '''
+    a card that answers the probe but never comes up holds the loop
+    for its init timeout on each of the few tries it gets, then is
+    given up. the lab keeps the timing it has with no card at all
+    '''
+    lines = {}
+    for name, options in (('no_card', ['--no-sd']), ('dead_card', ['--sd-dead'])):
+        trace = run(SHORT_MISSION, os.path.join(workdir, name), options)
+        lines[name] = [line for line in trace if len(line.split()) == 4]
+    if lines['dead_card'] != lines['no_card']:
+        fail("actuator edges differ from a flight with no card")
+
+
+CHECKS = [
+    ('two_missions', check_two_missions),
+    ('slow_card', check_slow_card),
+    ('late_card', check_late_card),
+    ('early_reset', check_early_reset),
+    ('dead_card', check_dead_card),
+]
+
+
+def main():
+    names = sys.argv[1:] or [name for name, check in CHECKS]
+    unknown = [name for name in names if name not in dict(CHECKS)]
+    if unknown:
+        raise SystemExit("unknown checks: " + ' '.join(unknown))
+
+    failures = 0
+    with tempfile.TemporaryDirectory() as workdir:
+        for name, check in CHECKS:
+            if name not in names:
+                continue
+            problems = []
+            check(workdir, problems.append)
+            print("{:20} {}".format(name, 'FAIL' if problems else 'ok'))
+            for problem in problems:
+                print("    " + problem)
+            failures += len(problems) > 0
+    if failures:
+        print(str(failures) + " checks failed")
+        sys.exit(1)
+
+main()
@@ -0,0 +1,678 @@
+// Host side of the HAL: the ATmega328P registers, the Arduino core
+// calls the sketch makes, and models of the peripherals it drives
+// (ADC, timer 1, USART0 receive, EEPROM writes), on a virtual clock.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <Arduino.h>
+#include <SD.h>
+#include <SPI.h>
+#include <avr/eeprom.h>
+#include <avr/sleep.h>
+
+#include "hal.h"
+
+#define SIM_REG8(name) volatile uint8_t name;
+#define SIM_REG16(name) volatile uint16_t name;
+
+SIM_REG8(PINB) SIM_REG8(DDRB) SIM_REG8(PORTB)
+SIM_REG8(PINC) SIM_REG8(DDRC) SIM_REG8(PORTC)
+SIM_REG8(PIND) SIM_REG8(DDRD) SIM_REG8(PORTD)
+SIM_REG8(ADMUX) SIM_REG8(ADCSRA) SIM_REG8(ADCSRB) SIM_REG8(DIDR0)
+SIM_REG16(ADC)
+SIM_REG8(TCCR1A) SIM_REG8(TCCR1B) SIM_REG8(TIMSK1)
+SIM_REG16(OCR1A) SIM_REG16(TCNT1)
+SIM_REG8(UCSR0A) SIM_REG8(UCSR0B) SIM_REG8(UCSR0C) SIM_REG8(UDR0)
+SIM_REG16(UBRR0)
+SIM_REG8(EECR) SIM_REG8(EEDR)
+SIM_REG16(EEAR)
+SIM_REG8(PRR) SIM_REG8(ACSR) SIM_REG8(SMCR) SIM_REG8(MCUSR) SIM_REG8(SREG)
+SIM_REG16(SP)
+
+uint64_t sim_now = 0;
+uint8_t sim_eeprom[SIM_EEPROM_SIZE];
+const char *sim_sd_root = ".";
+bool sim_sd_present = true;
+bool sim_sd_dead = false;
+uint16_t sim_adc_value[SIM_ADC_CHANNELS];
+uint32_t sim_sd_write_us = 0;
+uint32_t sim_sd_sync_us = 0;
+uint64_t (*sim_board)(uint64_t now) = NULL;
+
+// handlers the sketch leaves out. USART_RX_vect is the core's, below
+extern "C" {
+  void __attribute__((weak)) ADC_vect(void) {}
+  void __attribute__((weak)) TIMER1_COMPA_vect(void) {}
+  void __attribute__((weak)) EE_READY_vect(void) {}
+}
+
+// peripheral models
+
+static bool adc_busy = false;       // a conversion is running
+static uint64_t adc_done;           // when it finishes
+static uint8_t adc_mux;             // channel latched at its start
+
+static bool t1_on = false;          // timer 1 is counting in CTC mode
+static uint64_t t1_next;            // next compare match
+static uint64_t t1_period;          // us between matches
+
+static bool ee_busy = false;        // an EEPROM byte is being programmed
+static uint64_t ee_done;
+static uint16_t ee_addr;
+static uint8_t ee_data;
+
+static uint64_t board_next = UINT64_MAX;  // when sim_board wants to run again
+static uint64_t tick_next = SIM_TICK_US;  // next millis() tick interrupt
+
+// us that cycles more of CPU time take, carrying what is left of a
+// us over to the next charge
+static uint64_t cpu_us(uint32_t cycles) {
+  static uint32_t left = 0;
+  left += cycles;
+  uint64_t us = left / (SIM_F_CPU / 1000000);
+  left %= SIM_F_CPU / 1000000;
+  return us;
+}
+
+// charges an interrupt handler's cycles. interrupts are masked while
+// it runs, so nothing else is taken meanwhile
+static void sim_isr(void (*handler)(void), uint32_t cycles) {
+  handler();
+  sim_now += cpu_us(cycles);
+}
+
+// picks up whatever the sketch has started through the registers
+static void sim_start_peripherals() {
+  if ((ADCSRA & _BV(ADEN)) && (ADCSRA & _BV(ADSC)) && !adc_busy) {
+    uint8_t ps = ADCSRA & (_BV(ADPS2) | _BV(ADPS1) | _BV(ADPS0));
+    uint32_t prescale = ps == 0 ? 2 : 1 << ps;
+    adc_busy = true;
+    adc_mux = ADMUX & 0x0f;
+    adc_done = sim_now + 13ULL * prescale * 1000000 / SIM_F_CPU;
+  }
+
+  static const uint16_t t1_prescale[8] = { 0, 1, 8, 64, 256, 1024, 0, 0 };
+  uint16_t prescale = t1_prescale[TCCR1B & (_BV(CS12) | _BV(CS11) | _BV(CS10))];
+  if (prescale > 0 && (TCCR1B & _BV(WGM12))) {
+    uint64_t period = (OCR1A + 1ULL) * prescale * 1000000 / SIM_F_CPU;
+    if (!t1_on || period != t1_period) {
+      t1_on = true;
+      t1_period = period > 0 ? period : 1;
+      t1_next = sim_now + t1_period;
+    }
+  } else {
+    t1_on = false;
+  }
+
+  if ((EECR & _BV(EEPE)) && !ee_busy) {
+    ee_busy = true;
+    ee_addr = EEAR;
+    ee_data = EEDR;
+    ee_done = sim_now + SIM_EEPROM_WRITE_US;
+  }
+}
+
+void sim_service() {
+  if (sim_board) {
+    board_next = sim_board(sim_now);
+  }
+  for (;;) {
+    sim_start_peripherals();
+
+    if (adc_busy && adc_done <= sim_now) {
+      adc_busy = false;
+      ADC = sim_adc_value[adc_mux & (SIM_ADC_CHANNELS - 1)] & 0x3ff;
+      ADCSRA &= ~_BV(ADSC);
+      if (ADCSRA & _BV(ADIE)) {
+        sim_isr(ADC_vect, SIM_CYCLES_ADC_ISR);
+      }
+      continue;
+    }
+
+    if (t1_on && t1_next <= sim_now) {
+      t1_next += t1_period;
+      if (TIMSK1 & _BV(OCIE1A)) {
+        sim_isr(TIMER1_COMPA_vect, SIM_CYCLES_T1_ISR);
+      }
+      continue;
+    }
+
+    if (tick_next <= sim_now) {
+      tick_next += SIM_TICK_US;
+      sim_now += cpu_us(SIM_CYCLES_TICK_ISR);
+      continue;
+    }
+
+    if (ee_busy && ee_done <= sim_now) {
+      ee_busy = false;
+      sim_eeprom[ee_addr & (SIM_EEPROM_SIZE - 1)] = ee_data;
+      EECR &= ~_BV(EEPE);
+      continue;
+    }
+
+    // EE_READY is level triggered: it fires for as long as it is
+    // enabled and no write is in progress
+    if ((EECR & _BV(EERIE)) && !(EECR & _BV(EEPE))) {
+      sim_isr(EE_READY_vect, SIM_CYCLES_EE_ISR);
+      continue;
+    }
+    break;
+  }
+}
+
+uint64_t sim_next_event() {
+  sim_start_peripherals();
+  uint64_t next = (sim_now / SIM_TICK_US + 1) * SIM_TICK_US;
+  if (adc_busy && adc_done < next) {
+    next = adc_done;
+  }
+  if (t1_on && t1_next < next) {
+    next = t1_next;
+  }
+  if (ee_busy && ee_done < next) {
+    next = ee_done;
+  }
+  if (board_next < next) {
+    next = board_next;
+  }
+  if ((EECR & _BV(EERIE)) && !(EECR & _BV(EEPE))) {
+    next = sim_now;
+  }
+  return next;
+}
+
+void sim_busy(uint64_t us) {
+  uint64_t end = sim_now + us;
+  sim_service();
+  while (sim_now < end) {
+    uint64_t next = sim_next_event();
+    sim_now = next < end ? (next > sim_now ? next : sim_now + 1) : end;
+    sim_service();
+  }
+}
+
+void sim_cpu(uint32_t cycles) {
+  sim_busy(cpu_us(cycles));
+}
+
+void sim_uart_rx(uint8_t c, bool framing_error) {
+  if (!(UCSR0B & _BV(RXEN0))) {
+    return;
+  }
+  UDR0 = c;
+  UCSR0A = (UCSR0A & ~_BV(FE0)) | _BV(RXC0) | (framing_error ? _BV(FE0) : 0);
+  if (UCSR0B & _BV(RXCIE0)) {
+    sim_isr(USART_RX_vect, SIM_CYCLES_RX_ISR);
+  }
+}
+
+// Arduino core
+
+unsigned long millis() {
+  return sim_now / 1000;
+}
+
+unsigned long micros() {
+  return sim_now;
+}
+
+void delay(unsigned long ms) {
+  sim_busy(ms * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int us) {
+  sim_busy(us);
+}
+
+// port register and bit behind an Arduino pin number
+static void pin_regs(uint8_t pin, volatile uint8_t **port, volatile uint8_t **ddr,
+                     volatile uint8_t **in, uint8_t *mask) {
+  if (pin < 8) {
+    *port = &PORTD; *ddr = &DDRD; *in = &PIND; *mask = 1 << pin;
+  } else if (pin < 14) {
+    *port = &PORTB; *ddr = &DDRB; *in = &PINB; *mask = 1 << (pin - 8);
+  } else {
+    *port = &PORTC; *ddr = &DDRC; *in = &PINC; *mask = 1 << (pin - 14);
+  }
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  volatile uint8_t *port, *ddr, *in;
+  uint8_t mask;
+  pin_regs(pin, &port, &ddr, &in, &mask);
+  if (mode == OUTPUT) {
+    *ddr |= mask;
+  } else {
+    *ddr &= ~mask;
+    *port = mode == INPUT_PULLUP ? (*port | mask) : (*port & ~mask);
+  }
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  volatile uint8_t *port, *ddr, *in;
+  uint8_t mask;
+  pin_regs(pin, &port, &ddr, &in, &mask);
+  *port = value ? (*port | mask) : (*port & ~mask);
+}
+
+int digitalRead(uint8_t pin) {
+  volatile uint8_t *port, *ddr, *in;
+  uint8_t mask;
+  pin_regs(pin, &port, &ddr, &in, &mask);
+  return (*in & mask) ? HIGH : LOW;
+}
+
+int analogRead(uint8_t pin) {
+  return sim_adc_value[(pin >= A0 ? pin - A0 : pin) & (SIM_ADC_CHANNELS - 1)] & 0x3ff;
+}
+
+char *dtostrf(double value, signed char width, unsigned char prec, char *buf) {
+  sprintf(buf, "%*.*f", width, prec, value);
+  return buf;
+}
+
+void set_sleep_mode(uint8_t) {}
+void sleep_enable() {}
+void sleep_disable() {}
+void sleep_cpu() {}
+
+// Print
+
+size_t Print::write(const uint8_t *buf, size_t n) {
+  size_t written = 0;
+  while (n--) {
+    written += write(*buf++);
+  }
+  return written;
+}
+
+size_t Print::print_number(unsigned long n, int base) {
+  char buf[8 * sizeof(n) + 1];
+  char *p = buf + sizeof(buf) - 1;
+  *p = '\0';
+  if (base < 2) {
+    base = 10;
+  }
+  do {
+    unsigned long digit = n % base;
+    *--p = digit < 10 ? '0' + digit : 'A' + digit - 10;
+    n /= base;
+  } while (n);
+  return write(p);
+}
+
+size_t Print::print(const __FlashStringHelper *s) {
+  return print(reinterpret_cast<const char *>(s));
+}
+
+size_t Print::print(const char *s) {
+  return write(s);
+}
+
+size_t Print::print(char c) {
+  return write(static_cast<uint8_t>(c));
+}
+
+size_t Print::print(unsigned char n, int base) {
+  return print_number(n, base);
+}
+
+size_t Print::print(int n, int base) {
+  return print(static_cast<long>(n), base);
+}
+
+size_t Print::print(unsigned int n, int base) {
+  return print_number(n, base);
+}
+
+size_t Print::print(long n, int base) {
+  if (n < 0 && base == DEC) {
+    return print('-') + print_number(-static_cast<unsigned long>(n), base);
+  }
+  return print_number(n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  return print_number(n, base);
+}
+
+size_t Print::print(double n, int digits) {
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.*f", digits, n);
+  return write(buf);
+}
+
+size_t Print::println() {
+  return write("\r\n");
+}
+
+// Serial and its RX vector, as in the core's HardwareSerial0.cpp. a
+// sketch that defined either would fail to link here as on the board
+HardwareSerial Serial;
+
+extern "C" void USART_RX_vect(void) {
+  Serial._rx_complete_irq();
+}
+
+void HardwareSerial::begin(unsigned long, uint8_t) {
+  UCSR0B |= _BV(RXEN0) | _BV(TXEN0) | _BV(RXCIE0);
+}
+
+// the core checks only for parity errors, which 8N1 never has, so a
+// byte with a bad stop bit is buffered like any other
+void HardwareSerial::_rx_complete_irq() {
+  uint8_t c = UDR0;
+  uint8_t next = (rx_head + 1) % SERIAL_RX_BUFFER_SIZE;
+  if (next != rx_tail) {
+    rx_buffer[rx_head] = c;
+    rx_head = next;
+  }
+}
+
+int HardwareSerial::available() {
+  return (SERIAL_RX_BUFFER_SIZE + rx_head - rx_tail) % SERIAL_RX_BUFFER_SIZE;
+}
+
+int HardwareSerial::peek() {
+  return rx_head == rx_tail ? -1 : rx_buffer[rx_tail];
+}
+
+int HardwareSerial::read() {
+  if (rx_head == rx_tail) {
+    return -1;
+  }
+  uint8_t c = rx_buffer[rx_tail];
+  rx_tail = (rx_tail + 1) % SERIAL_RX_BUFFER_SIZE;
+  sim_cpu(SIM_CYCLES_RX_BYTE);    // and the sketch's parse of it
+  return c;
+}
+
+size_t HardwareSerial::write(uint8_t c) {
+  fputc(c, stderr);
+  return 1;
+}
+
+// SD card, as files under sim_sd_root. the library keeps one
+// 512-byte sector cache for every file and the directory: touching a
+// sector outside it writes the cached one back if it is dirty, and
+// reads the new one in, unless a write starts it at the end of the
+// file. a whole-sector write goes straight to the card. each sector
+// the card reads or writes costs sim_sd_write_us
+
+static FILE *cache_fp = NULL;       // file whose sector is cached
+static uint32_t cache_block;
+static bool cache_dirty = false;
+
+// the card time for file fp's sector block to be in the cache
+static uint64_t sd_cache(FILE *fp, uint32_t block, bool write, bool fresh) {
+  if (cache_fp == fp && cache_block == block) {
+    cache_dirty = cache_dirty || write;
+    return 0;
+  }
+  uint64_t us = (cache_dirty ? sim_sd_write_us : 0) + (fresh ? 0 : sim_sd_write_us);
+  cache_fp = fp;
+  cache_block = block;
+  cache_dirty = write;
+  return us;
+}
+
+// the card time for a write of n bytes at start, to a file that was
+// size bytes long
+static uint64_t sd_write_cost(FILE *fp, uint32_t start, uint32_t n, uint32_t size) {
+  uint64_t us = 0;
+  for (uint32_t pos = start; pos < start + n; pos = (pos / 512 + 1) * 512) {
+    uint32_t block = pos / 512;
+    if (pos % 512 == 0 && start + n - pos >= 512) {
+      us += sim_sd_write_us;
+      if (cache_fp == fp && cache_block == block) {
+        cache_fp = NULL;
+        cache_dirty = false;
+      }
+    } else {
+      us += sd_cache(fp, block, true, pos % 512 == 0 && pos >= size);
+    }
+  }
+  return us;
+}
+
+// where a host file's next access goes, its length, and whether it
+// was written since the last flush. kept by descriptor, so copies of
+// a File share them, like the library's. the data goes straight to
+// the host with pread and pwrite: stdio would flush its buffer on
+// each of the sketch's seeks
+struct SimFile {
+  uint32_t pos;
+  uint32_t len;
+  bool dirty;
+};
+static SimFile sim_files[SIM_FILES_MAX];
+
+size_t File::write(const uint8_t *buf, size_t n) {
+  if (!fp || !(mode & O_WRITE)) {
+    return 0;
+  }
+  SimFile &f = sim_files[fileno(fp)];
+  if (mode & O_APPEND) {
+    f.pos = f.len;
+  }
+  ssize_t written = pwrite(fileno(fp), buf, n, f.pos);
+  if (written <= 0) {
+    return 0;
+  }
+  uint64_t us = sd_write_cost(fp, f.pos, written, f.len);
+  f.pos += written;
+  f.len = f.pos > f.len ? f.pos : f.len;
+  f.dirty = true;
+  sim_busy(us);
+  return written;
+}
+
+// the card's share of a flush or close: the cached sector and the
+// directory entry, which is left in the cache
+static void sd_sync(bool &dirty) {
+  if (dirty) {
+    dirty = false;
+    cache_fp = NULL;
+    cache_dirty = false;
+    sim_busy(sim_sd_sync_us);
+  }
+}
+
+int File::read(void *buf, uint16_t n) {
+  if (!fp) {
+    return -1;
+  }
+  SimFile &f = sim_files[fileno(fp)];
+  ssize_t got = pread(fileno(fp), buf, n, f.pos);
+  if (got < 0) {
+    return -1;
+  }
+  uint64_t us = 0;
+  for (uint32_t pos = f.pos; pos < f.pos + got; pos = (pos / 512 + 1) * 512) {
+    us += sd_cache(fp, pos / 512, false, false);
+  }
+  f.pos += got;
+  sim_busy(us);
+  return got;
+}
+
+int File::read() {
+  uint8_t c;
+  return read(&c, 1) == 1 ? c : -1;
+}
+
+int File::peek() {
+  int c = read();
+  if (c >= 0) {
+    sim_files[fileno(fp)].pos--;
+  }
+  return c;
+}
+
+int File::available() {
+  return fp ? size() - position() : 0;
+}
+
+bool File::seek(uint32_t pos) {
+  if (!fp) {
+    return false;
+  }
+  sim_files[fileno(fp)].pos = pos;
+  return true;
+}
+
+uint32_t File::position() {
+  return fp ? sim_files[fileno(fp)].pos : 0;
+}
+
+uint32_t File::size() {
+  return fp ? sim_files[fileno(fp)].len : 0;
+}
+
+void File::flush() {
+  if (fp) {
+    sd_sync(sim_files[fileno(fp)].dirty);
+  }
+}
+
+void File::close() {
+  if (fp) {
+    sd_sync(sim_files[fileno(fp)].dirty);
+    if (cache_fp == fp) {
+      cache_fp = NULL;          // its FILE may be reused
+    }
+    fclose(fp);
+    fp = NULL;
+  }
+}
+
+SPIClass SPI;
+
+void SPIClass::beginTransaction(SPISettings settings) {
+  byte_us = 8000000 / (settings.clock ? settings.clock : 1);
+}
+
+// an empty slot's MISO reads all ones. a card answers a CMD0 frame
+// (0x40 and five more bytes) with R1 idle on the next byte
+uint8_t SPIClass::transfer(uint8_t b) {
+  sim_busy(byte_us);
+  if (!sim_sd_present) {
+    return 0xff;
+  }
+  if (r1_due) {
+    r1_due = false;
+    return 0x01;
+  }
+  if (cmd_left > 0) {
+    r1_due = --cmd_left == 0;
+  } else if (b == 0x40) {
+    cmd_left = 5;
+  }
+  return 0xff;
+}
+
+SDClass SD;
+
+// host path of a file on the card
+static void sd_path(char *buf, size_t n, const char *path) {
+  snprintf(buf, n, "%s/%s", sim_sd_root, path);
+}
+
+// like the SD library's, a begin() after one that succeeded fails,
+// as the root directory is already open
+bool SDClass::begin(uint8_t) {
+  static bool begun = false;
+  if (sim_sd_present && sim_sd_dead) {
+    sim_busy(SIM_SD_INIT_US);
+    return false;
+  }
+  if (!sim_sd_present || begun) {
+    return false;
+  }
+  begun = true;
+  return true;
+}
+
+File SDClass::open(const char *path, uint8_t mode) {
+  if (!sim_sd_present) {
+    return File();
+  }
+  char host[512];
+  sd_path(host, sizeof(host), path);
+
+  FILE *fp;
+  if (!(mode & O_WRITE)) {
+    fp = fopen(host, "rb");
+  } else if (mode & O_TRUNC) {
+    fp = fopen(host, "w+b");
+  } else {
+    fp = fopen(host, "r+b");
+    if (!fp && (mode & O_CREAT)) {
+      fp = fopen(host, "w+b");
+    }
+  }
+  if (fp && fileno(fp) >= SIM_FILES_MAX) {
+    fclose(fp);
+    fp = NULL;
+  }
+  if (fp) {
+    SimFile &f = sim_files[fileno(fp)];
+    fseek(fp, 0, SEEK_END);
+    f.len = ftell(fp);
+    f.pos = 0;
+    f.dirty = false;
+  }
+  return File(fp, mode);
+}
+
+bool SDClass::exists(const char *path) {
+  char host[512];
+  sd_path(host, sizeof(host), path);
+  return access(host, F_OK) == 0;
+}
+
+bool SDClass::remove(const char *path) {
+  char host[512];
+  sd_path(host, sizeof(host), path);
+  return ::remove(host) == 0;
+}
+
+// EEPROM library calls
+
+static uint16_t ee_index(const void *addr) {
+  return reinterpret_cast<uintptr_t>(addr) & (SIM_EEPROM_SIZE - 1);
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t n) {
+  uint8_t *d = static_cast<uint8_t *>(dst);
+  for (size_t i = 0; i < n; i++) {
+    d[i] = sim_eeprom[(ee_index(src) + i) & (SIM_EEPROM_SIZE - 1)];
+  }
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t n) {
+  const uint8_t *s = static_cast<const uint8_t *>(src);
+  for (size_t i = 0; i < n; i++) {
+    sim_eeprom[(ee_index(dst) + i) & (SIM_EEPROM_SIZE - 1)] = s[i];
+  }
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr) {
+  return sim_eeprom[ee_index(addr)];
+}
+
+uint16_t eeprom_read_word(const uint16_t *addr) {
+  uint16_t w;
+  eeprom_read_block(&w, addr, sizeof(w));
+  return w;
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value) {
+  sim_eeprom[ee_index(addr)] = value;
+}
+
+void eeprom_update_word(uint16_t *addr, uint16_t value) {
+  eeprom_update_block(&value, addr, sizeof(value));
+}
@@ -0,0 +1,77 @@
+// The simulator's side of the HAL: the virtual clock, and the
+// peripheral models that raise the sketch's interrupts.
+
+#ifndef SIM_HAL_H
+#define SIM_HAL_H
+
+#include <stdint.h>
+
+#define SIM_F_CPU 16000000UL
+#define SIM_EEPROM_SIZE 1024
+#define SIM_EEPROM_WRITE_US 3400    // one byte, from the datasheet
+#define SIM_TICK_US 1000            // millis() tick, which also wakes the core
+#define SIM_BYTE_US 87              // one 8N1 byte at 115200 baud
+#define SIM_SD_INIT_US 2000000      // SD.begin() giving up on a card that won't init
+#define SIM_ADC_CHANNELS 8
+#define SIM_FILES_MAX 64            // host descriptors the card's files may use
+
+// CPU cycles charged to the clock for the sketch's own work, estimated
+// from the code each one runs, with ~40 cycles of register saves and
+// restores for an interrupt. the rest of the sketch takes no time
+#define SIM_CYCLES_RX_ISR 75        // the core's USART_RX_vect
+#define SIM_CYCLES_TICK_ISR 80      // the core's TIMER0_OVF_vect behind millis()
+#define SIM_CYCLES_ADC_ISR 70       // one conversion into the oversampled scan
+#define SIM_CYCLES_T1_ISR 90        // a sample into the fifo
+#define SIM_CYCLES_EE_ISR 60        // one checkpoint byte queued to the EEPROM
+#define SIM_CYCLES_RX_BYTE 200      // Serial.read() and parser_feed() of a byte
+#define SIM_CYCLES_LOOP 500         // a loop() pass: the serial poll and the task scan
+
+// virtual time since reset (us)
+extern uint64_t sim_now;
+
+// the EEPROM image, loaded from and saved to the output directory
+extern uint8_t sim_eeprom[SIM_EEPROM_SIZE];
+
+// directory holding the simulated card's files
+extern const char *sim_sd_root;
+
+// false empties the card slot: the SPI probe goes unanswered and
+// SD.begin() fails. the board may set it later to insert the card
+extern bool sim_sd_present;
+
+// a card that answers the probe but never finishes init, so every
+// SD.begin() runs out its SIM_SD_INIT_US timeout and fails
+extern bool sim_sd_dead;
+
+// 10-bit reading the ADC returns for each mux channel
+extern uint16_t sim_adc_value[SIM_ADC_CHANNELS];
+
+// card timing: how long the card holds the bus for each 512-byte
+// sector read or written, and for each flush or close of a file with
+// new data
+extern uint32_t sim_sd_write_us;
+extern uint32_t sim_sd_sync_us;
+
+// the board around the chip, called every time peripherals are
+// serviced. it drives the RX line and watches the pins, and returns
+// when it next needs to run
+extern uint64_t (*sim_board)(uint64_t now);
+
+// puts one byte on the RX line. framing_error marks a bad stop bit
+void sim_uart_rx(uint8_t c, bool framing_error);
+
+// runs every peripheral event due by sim_now, with its interrupt
+void sim_service();
+
+// time of the next peripheral event, no later than the next millis() tick
+uint64_t sim_next_event();
+
+// runs the clock us forward while the core is busy in a driver or a
+// delay, with interrupts still being taken
+void sim_busy(uint64_t us);
+
+// runs the clock forward for cycles of the sketch's own work, with
+// interrupts still being taken
+void sim_cpu(uint32_t cycles);
+
+#endif  // SIM_HAL_H
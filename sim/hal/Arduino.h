@@ -0,0 +1,120 @@
+// Host stand-in for the parts of the Arduino core the sketch uses.
+// Time comes from the simulator's virtual clock, and Print writes
+// through whatever sink the object provides.
+
+#ifndef SIM_ARDUINO_H
+#define SIM_ARDUINO_H
+
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <avr/interrupt.h>
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+
+#define DEC 10
+#define HEX 16
+
+#define LSBFIRST 0
+#define MSBFIRST 1
+
+#define A0 14
+#define A1 15
+#define A2 16
+#define A3 17
+#define A4 18
+#define A5 19
+
+#define SERIAL_8N1 0x06
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalRead(uint8_t pin);
+int analogRead(uint8_t pin);
+
+char *dtostrf(double value, signed char width, unsigned char prec, char *buf);
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper *>(s))
+
+class Print {
+ public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t n);
+  size_t write(const char *s) { return write(reinterpret_cast<const uint8_t *>(s), strlen(s)); }
+  virtual void flush() {}
+
+  size_t print(const __FlashStringHelper *s);
+  size_t print(const char *s);
+  size_t print(char c);
+  size_t print(unsigned char n, int base = DEC);
+  size_t print(int n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC);
+  size_t print(long n, int base = DEC);
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(double n, int digits = 2);
+
+  size_t println();
+  template <typename T> size_t println(const T &x) { size_t n = print(x); return n + println(); }
+  template <typename T> size_t println(const T &x, int arg) { size_t n = print(x, arg); return n + println(); }
+
+ private:
+  size_t print_number(unsigned long n, int base);
+};
+
+class Stream : public Print {
+ public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+};
+
+// USART0 the way the core drives it: begin() turns the receiver and
+// its interrupt on, and the core's USART_RX_vect fills a
+// SERIAL_RX_BUFFER_SIZE ring, dropping bytes once it is full. output
+// goes to stderr
+#define SERIAL_RX_BUFFER_SIZE 64
+
+class HardwareSerial : public Stream {
+ public:
+  void begin(unsigned long baud, uint8_t config = SERIAL_8N1);
+  void end() {}
+  operator bool() { return true; }
+  int available();
+  int read();
+  int peek();
+  size_t write(uint8_t c);
+  using Print::write;
+
+  void _rx_complete_irq();
+
+ private:
+  volatile uint8_t rx_head = 0;
+  volatile uint8_t rx_tail = 0;
+  uint8_t rx_buffer[SERIAL_RX_BUFFER_SIZE];
+};
+
+extern HardwareSerial Serial;
+
+void setup();
+void loop();
+
+#endif  // SIM_ARDUINO_H
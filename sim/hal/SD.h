@@ -0,0 +1,58 @@
+// Host stand-in for the Arduino SD library. The card is a directory
+// on the host (see sim_sd_root), and each File wraps a host file.
+
+#ifndef SIM_SD_H
+#define SIM_SD_H
+
+#include <stdio.h>
+
+#include <Arduino.h>
+
+#define O_READ 0x01
+#define O_RDONLY O_READ
+#define O_WRITE 0x02
+#define O_RDWR (O_READ | O_WRITE)
+#define O_APPEND 0x04
+#define O_SYNC 0x08
+#define O_CREAT 0x10
+#define O_EXCL 0x20
+#define O_TRUNC 0x40
+
+#define FILE_READ O_READ
+#define FILE_WRITE (O_READ | O_WRITE | O_CREAT | O_APPEND)
+
+class File : public Stream {
+ public:
+  File() : fp(NULL), mode(0) {}
+  File(FILE *fp, uint8_t mode) : fp(fp), mode(mode) {}
+
+  operator bool() { return fp != NULL; }
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t *buf, size_t n);
+  using Print::write;
+  int read(void *buf, uint16_t n);
+  int read();
+  int peek();
+  int available();
+  bool seek(uint32_t pos);
+  uint32_t position();
+  uint32_t size();
+  void flush();
+  void close();
+
+ private:
+  FILE *fp;     // opened by stdio, read and written by descriptor
+  uint8_t mode;
+};
+
+class SDClass {
+ public:
+  bool begin(uint8_t cs_pin);
+  File open(const char *path, uint8_t mode = FILE_READ);
+  bool exists(const char *path);
+  bool remove(const char *path);
+};
+
+extern SDClass SD;
+
+#endif  // SIM_SD_H
@@ -0,0 +1,37 @@
+// Host stand-in for <SPI.h>. The simulated SD card is files on the
+// host, so the bus only has to answer the sketch's CMD0 probe: with
+// a card present, the byte after a CMD0 frame reads back R1 idle.
+
+#ifndef SIM_SPI_H
+#define SIM_SPI_H
+
+#include <Arduino.h>
+
+#define SPI_MODE0 0x00
+
+class SPISettings {
+ public:
+  SPISettings(uint32_t clock, uint8_t bit_order, uint8_t data_mode) : clock(clock) {
+    (void)bit_order;
+    (void)data_mode;
+  }
+  uint32_t clock;
+};
+
+class SPIClass {
+ public:
+  SPIClass() : byte_us(32), cmd_left(0), r1_due(false) {}
+  void begin() {}
+  void beginTransaction(SPISettings settings);
+  void endTransaction() {}
+  uint8_t transfer(uint8_t b);
+
+ private:
+  uint32_t byte_us;   // 8 clocks at the transaction's speed
+  uint8_t cmd_left;   // bytes still to come of a CMD0 frame
+  bool r1_due;
+};
+
+extern SPIClass SPI;
+
+#endif  // SIM_SPI_H
@@ -0,0 +1,20 @@
+// Host stand-in for <avr/eeprom.h>, backed by the simulator's
+// EEPROM image. Register-level writes through EECR/EEDR/EEAR land
+// in the same image once the simulated write time has passed.
+
+#ifndef SIM_AVR_EEPROM_H
+#define SIM_AVR_EEPROM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+void eeprom_read_block(void *dst, const void *src, size_t n);
+void eeprom_update_block(const void *src, void *dst, size_t n);
+uint8_t eeprom_read_byte(const uint8_t *addr);
+uint16_t eeprom_read_word(const uint16_t *addr);
+void eeprom_update_byte(uint8_t *addr, uint8_t value);
+void eeprom_update_word(uint16_t *addr, uint16_t value);
+
+#define eeprom_busy_wait()
+
+#endif  // SIM_AVR_EEPROM_H
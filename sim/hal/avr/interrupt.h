@@ -0,0 +1,20 @@
+// Host stand-in for <avr/interrupt.h>. Interrupt handlers become
+// plain functions the simulator calls between loop() passes, so
+// there is nothing to mask.
+
+#ifndef SIM_AVR_INTERRUPT_H
+#define SIM_AVR_INTERRUPT_H
+
+#define ISR(vector) extern "C" void vector(void)
+
+extern "C" {
+  void USART_RX_vect(void);
+  void ADC_vect(void);
+  void TIMER1_COMPA_vect(void);
+  void EE_READY_vect(void);
+}
+
+#define cli()
+#define sei()
+
+#endif  // SIM_AVR_INTERRUPT_H
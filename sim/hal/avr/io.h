@@ -0,0 +1,138 @@
+// Host stand-in for <avr/io.h>: the ATmega328P registers the sketch
+// touches, as plain variables. The simulator watches them between
+// interrupts and loop() passes, the way the hardware would.
+
+#ifndef SIM_AVR_IO_H
+#define SIM_AVR_IO_H
+
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+
+#define SIM_REG8(name) extern volatile uint8_t name;
+#define SIM_REG16(name) extern volatile uint16_t name;
+
+// ports
+SIM_REG8(PINB) SIM_REG8(DDRB) SIM_REG8(PORTB)
+SIM_REG8(PINC) SIM_REG8(DDRC) SIM_REG8(PORTC)
+SIM_REG8(PIND) SIM_REG8(DDRD) SIM_REG8(PORTD)
+
+// ADC
+SIM_REG8(ADMUX) SIM_REG8(ADCSRA) SIM_REG8(ADCSRB) SIM_REG8(DIDR0)
+SIM_REG16(ADC)
+
+// timer 1
+SIM_REG8(TCCR1A) SIM_REG8(TCCR1B) SIM_REG8(TIMSK1)
+SIM_REG16(OCR1A) SIM_REG16(TCNT1)
+
+// USART0
+SIM_REG8(UCSR0A) SIM_REG8(UCSR0B) SIM_REG8(UCSR0C) SIM_REG8(UDR0)
+SIM_REG16(UBRR0)
+#define UBRR0L (reinterpret_cast<volatile uint8_t *>(&UBRR0)[0])
+#define UBRR0H (reinterpret_cast<volatile uint8_t *>(&UBRR0)[1])
+
+// EEPROM
+SIM_REG8(EECR) SIM_REG8(EEDR)
+SIM_REG16(EEAR)
+
+// system
+SIM_REG8(PRR) SIM_REG8(ACSR) SIM_REG8(SMCR) SIM_REG8(MCUSR) SIM_REG8(SREG)
+SIM_REG16(SP)
+
+#undef SIM_REG8
+#undef SIM_REG16
+
+#define RAMSTART 0x100
+#define RAMEND 0x8ff
+#define E2END 0x3ff
+
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PB6 6
+#define PB7 7
+#define PC0 0
+#define PC1 1
+#define PC2 2
+#define PC3 3
+#define PC4 4
+#define PC5 5
+#define PC6 6
+#define PD0 0
+#define PD1 1
+#define PD2 2
+#define PD3 3
+#define PD4 4
+#define PD5 5
+#define PD6 6
+#define PD7 7
+
+// ADMUX
+#define REFS1 7
+#define REFS0 6
+#define ADLAR 5
+
+// ADCSRA
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+
+// TCCR1B
+#define WGM13 4
+#define WGM12 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+
+// TIMSK1
+#define OCIE1B 2
+#define OCIE1A 1
+#define TOIE1 0
+
+// UCSR0A
+#define RXC0 7
+#define TXC0 6
+#define UDRE0 5
+#define FE0 4
+#define DOR0 3
+#define UPE0 2
+#define U2X0 1
+
+// UCSR0B
+#define RXCIE0 7
+#define TXCIE0 6
+#define UDRIE0 5
+#define RXEN0 4
+#define TXEN0 3
+
+// UCSR0C
+#define UCSZ01 2
+#define UCSZ00 1
+
+// EECR
+#define EERIE 3
+#define EEMPE 2
+#define EEPE 1
+#define EERE 0
+
+// PRR
+#define PRTWI 7
+#define PRTIM2 6
+#define PRTIM0 5
+#define PRTIM1 3
+#define PRSPI 2
+#define PRUSART0 1
+#define PRADC 0
+
+// ACSR
+#define ACD 7
+
+#endif  // SIM_AVR_IO_H
@@ -0,0 +1,30 @@
+// Host stand-in for <avr/pgmspace.h>. There is one address space
+// on the host, so flash reads are plain reads.
+
+#ifndef SIM_AVR_PGMSPACE_H
+#define SIM_AVR_PGMSPACE_H
+
+#include <stdint.h>
+#include <string.h>
+
+#define PROGMEM
+#define PSTR(s) (s)
+
+// copied out rather than cast, so the reads don't fall foul of strict
+// aliasing or alignment on the host
+template <typename T>
+static inline T sim_pgm_read(const void *addr) {
+  T value;
+  memcpy(&value, addr, sizeof(value));
+  return value;
+}
+
+#define pgm_read_byte(addr) sim_pgm_read<uint8_t>(addr)
+#define pgm_read_word(addr) sim_pgm_read<uint16_t>(addr)
+#define pgm_read_dword(addr) sim_pgm_read<uint32_t>(addr)
+#define pgm_read_ptr(addr) sim_pgm_read<const void *>(addr)
+
+#define memcpy_P memcpy
+#define strlen_P strlen
+
+#endif  // SIM_AVR_PGMSPACE_H
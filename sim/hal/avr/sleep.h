@@ -0,0 +1,18 @@
+// Host stand-in for <avr/sleep.h>. sleep_cpu() tells the simulator
+// the core is idle, so it can skip ahead to the next interrupt.
+
+#ifndef SIM_AVR_SLEEP_H
+#define SIM_AVR_SLEEP_H
+
+#include <stdint.h>
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC 1
+#define SLEEP_MODE_PWR_DOWN 2
+
+void set_sleep_mode(uint8_t mode);
+void sleep_enable();
+void sleep_disable();
+void sleep_cpu();
+
+#endif  // SIM_AVR_SLEEP_H
@@ -0,0 +1,12 @@
+// Host stand-in for <util/atomic.h>. Handlers never preempt the
+// sketch in the simulator, so an atomic block is just a block.
+
+#ifndef SIM_UTIL_ATOMIC_H
+#define SIM_UTIL_ATOMIC_H
+
+#define ATOMIC_RESTORESTATE 0
+#define ATOMIC_FORCEON 1
+
+#define ATOMIC_BLOCK(type) for (bool sim_atomic_once = true; sim_atomic_once; sim_atomic_once = false)
+
+#endif  // SIM_UTIL_ATOMIC_H
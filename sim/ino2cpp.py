@@ -0,0 +1,48 @@
+'''
+turns an Arduino sketch into plain C++ the way the Arduino builder
+does: includes Arduino.h, and declares every function ahead of the
+first definition so they can be called before they are defined
+
+usage: python3 ino2cpp.py sketch.ino > sketch.cpp
+'''
+
+import re
+import sys
+
+# a function definition at the start of a line: return type, name, parameters, {
+FUNCTION = re.compile(r'^(?!(?:typedef|struct|enum|class|template|static_assert|return|else|if|for|while|switch|case)\b)'
+                      r'[A-Za-z_][\w:<>\s\*&,]*?[\s\*&]([A-Za-z_]\w*)\s*\(([^;{}()]*)\)\s*\{', re.M)
+
+def main():
+    if len(sys.argv) < 2:
+        print("usage: python3 ino2cpp.py sketch.ino > sketch.cpp")
+        return
+
+    path = sys.argv[1]
+    with open(path) as f:
+        src = f.read()
+
+    prototypes = []
+    first = None
+    for m in FUNCTION.finditer(src):
+        name = m.group(1)
+        head = m.group(0)[:-1].strip()
+        if first is None:
+            first = m.start()
+        if name == 'ISR' or head.startswith('constexpr') or head.startswith('inline'):
+            continue
+        prototypes.append(' '.join(head.split()) + ';')
+
+    if first is None:
+        first = len(src)
+    line = src.count('\n', 0, first) + 1
+
+    out = sys.stdout
+    out.write('#include <Arduino.h>\n')
+    out.write('#line 1 "' + path + '"\n')
+    out.write(src[:first])
+    out.write('\n'.join(prototypes) + '\n')
+    out.write('#line ' + str(line) + ' "' + path + '"\n')
+    out.write(src[first:])
+
+main()
@@ -0,0 +1,372 @@
+// Replays a flight profile against the flight controller sketch on a
+// virtual clock. Blue packets are fed to the UART a byte at a time at
+// 115200 baud, the ADC, timer 1 and EEPROM are modelled, and whenever
+// the sketch sleeps the clock skips ahead to the next event, so a
+// mission runs far faster than real time.
+//
+// The card's files and the EEPROM image are kept in the output
+// directory. Running again with --from against the same directory
+// is a reset at that point in the flight.
+//
+// Profiles here take only "<phase> <seconds> [packet period ms]" and
+// "- <seconds>" dropouts. For jitter, bursts, corruption and drops let
+// serial_simulator.py --write build the stream and run it with --stream.
+//
+// Output is one line per event: "<profile time (s)> boot", "... phase
+// <letter>" once the last byte of the first packet of a phase is on
+// the line, "... <pin> <device> <level>" for every actuator edge, and
+// "... card in" when --sd-insert puts the card in.
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include <string>
+#include <vector>
+
+#include <Arduino.h>
+
+#include "hal.h"
+
+#define DEFAULT_PACKET_PERIOD 100     // ms
+#define BLUE_EPOCH 1600000000UL       // Blue time at profile time 0 (s)
+
+// the 19 fields after phase and time, as serial_simulator.py sends them
+#define PAYLOAD ",9697.791016,-216.117355,0.239193,-0.373560,32.779297,0.000000,0.000000," \
+                "-0.272123,-0.004113,0.000209,-0.001000,0.000000,0.000000,0,0,0,1,0,0"
+
+// an actuator output, mirroring the pin defines in blue_origin_fc.ino
+typedef struct wire_st {
+  volatile uint8_t *port;
+  volatile uint8_t *ddr;
+  uint8_t bit;
+  const char *pin;
+  const char *device;
+} Wire;
+
+static const Wire wires[] = {
+  { &PORTD, &DDRD, 2, "D2", "PUMP_POWER" },
+  { &PORTD, &DDRD, 3, "D3", "MOTOR" },
+  { &PORTD, &DDRD, 5, "D5", "PUMP_1" },
+  { &PORTD, &DDRD, 6, "D6", "PUMP_2" },
+  { &PORTB, &DDRB, 0, "D8", "SOL_1" },
+  { &PORTB, &DDRB, 1, "D9", "SOL_2" },
+  { &PORTB, &DDRB, 2, "D10", "SOL_3" },
+  { &PORTC, &DDRC, 5, "A5", "EXPERIMENT" },
+};
+#define NUM_WIRES (sizeof(wires) / sizeof(wires[0]))
+
+// one Blue packet, on the line from t (profile us)
+typedef struct packet_st {
+  uint64_t t;
+  char phase;
+  std::string bytes;
+} Packet;
+
+static std::vector<Packet> packets;
+static uint64_t profile_start = 0;    // profile time at reset (us)
+static bool quiet = false;
+static uint64_t sd_insert = 0;        // profile time the card goes in (us)
+
+// last level seen on each wire, -1 before it is an output
+static int wire_level[NUM_WIRES];
+
+// the next byte to go out on the RX line
+static size_t next_packet = 0;
+static size_t next_byte = 0;
+static char last_phase = 0;
+
+static double profile_seconds(uint64_t boot_us) {
+  return (boot_us + profile_start) / 1e6;
+}
+
+// reads "<phase> <seconds> [packet period ms]" lines into packets
+static bool load_profile(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  char line[256];
+  uint64_t t = 0;
+  int n = 0;
+  while (fgets(line, sizeof(line), f)) {
+    n++;
+    char *p = line + strspn(line, " \t");
+    if (*p == '#' || *p == '\n' || *p == '\0') {
+      continue;
+    }
+
+    char phase;
+    double seconds;
+    unsigned period = DEFAULT_PACKET_PERIOD;
+    if (sscanf(p, "%c %lf %u", &phase, &seconds, &period) < 2 || period == 0) {
+      fprintf(stderr, "%s:%d: expected <phase> <seconds> [period ms]\n", path, n);
+      fclose(f);
+      return false;
+    }
+
+    uint64_t end = t + static_cast<uint64_t>(seconds * 1e6);
+    if (phase == '-') {
+      t = end;
+      continue;
+    }
+    for (; t < end; t += period * 1000ULL) {
+      char buf[256];
+      uint64_t ms = t / 1000 % 1000;
+      snprintf(buf, sizeof(buf), "%c,%lu.%02u%s", phase,
+               static_cast<unsigned long>(BLUE_EPOCH + t / 1000000),
+               static_cast<unsigned>(ms / 10), PAYLOAD);
+      Packet pkt = { t, phase, buf };
+      packets.push_back(pkt);
+    }
+    t = end;
+  }
+  fclose(f);
+  return true;
+}
+
+// reads the "<send time ms> <packet>" lines serial_simulator.py --write
+// makes, with \xNN escapes, into packets
+static bool load_stream(const char *path) {
+  FILE *f = fopen(path, "r");
+  if (!f) {
+    fprintf(stderr, "%s: %s\n", path, strerror(errno));
+    return false;
+  }
+
+  char line[512];
+  int n = 0;
+  while (fgets(line, sizeof(line), f)) {
+    n++;
+    double ms;
+    int text;
+    if (sscanf(line, "%lf %n", &ms, &text) < 1 || ms < 0) {
+      fprintf(stderr, "%s:%d: expected <send time ms> <packet>\n", path, n);
+      fclose(f);
+      return false;
+    }
+
+    Packet pkt = { static_cast<uint64_t>(ms * 1000), 0, "" };
+    for (const char *p = line + text; *p && *p != '\n'; p++) {
+      unsigned c = *p;
+      if (c == '\\' && sscanf(p, "\\x%2x", &c) == 1) {
+        p += 3;
+      }
+      pkt.bytes += static_cast<char>(c);
+    }
+    if (!pkt.bytes.empty()) {
+      pkt.phase = pkt.bytes[0];
+      packets.push_back(pkt);
+    }
+  }
+  fclose(f);
+  return true;
+}
+
+// one UART: a packet due while the last is still going out waits for it
+static void serialize_packets() {
+  for (size_t i = 1; i < packets.size(); i++) {
+    uint64_t free = packets[i - 1].t + packets[i - 1].bytes.size() * SIM_BYTE_US;
+    if (packets[i].t < free) {
+      packets[i].t = free;
+    }
+  }
+}
+
+// prints every actuator edge since the last call
+static void trace_wires() {
+  // the sketch is serviced millions of times a mission, and the
+  // outputs hardly ever change between two of them
+  static uint8_t last[6];
+  const uint8_t now[6] = { PORTB, PORTC, PORTD, DDRB, DDRC, DDRD };
+  if (memcmp(now, last, sizeof(now)) == 0) {
+    return;
+  }
+  memcpy(last, now, sizeof(now));
+
+  for (size_t i = 0; i < NUM_WIRES; i++) {
+    const Wire &w = wires[i];
+    int level = (*w.ddr & _BV(w.bit)) ? (*w.port >> w.bit) & 1 : -1;
+    if (level != wire_level[i]) {
+      wire_level[i] = level;
+      if (level >= 0 && !quiet) {
+        printf("%.6f %s %s %d\n", profile_seconds(sim_now), w.pin, w.device, level);
+      }
+    }
+  }
+}
+
+// the RX line and the actuators: puts every byte whose stop bit is
+// done by now on the line and traces pin edges. returns boot time of
+// the next byte's stop bit
+static uint64_t board(uint64_t now) {
+  trace_wires();
+  if (sd_insert > 0 && now + profile_start >= sd_insert && !sim_sd_present) {
+    sim_sd_present = true;
+    if (!quiet) {
+      printf("%.6f card in\n", profile_seconds(now));
+    }
+  }
+  while (next_packet < packets.size()) {
+    const Packet &pkt = packets[next_packet];
+    uint64_t at = pkt.t + (next_byte + 1) * SIM_BYTE_US;
+    if (at > now + profile_start) {
+      return at - profile_start;
+    }
+    sim_uart_rx(pkt.bytes[next_byte], false);
+    if (++next_byte == pkt.bytes.size()) {
+      if (pkt.phase != last_phase && !quiet) {
+        printf("%.6f phase %c\n", at / 1e6, pkt.phase);
+      }
+      last_phase = pkt.phase;
+      next_packet++;
+      next_byte = 0;
+    }
+  }
+  return UINT64_MAX;
+}
+
+static void load_eeprom(const char *path) {
+  memset(sim_eeprom, 0xff, sizeof(sim_eeprom));   // erased cells
+  FILE *f = fopen(path, "rb");
+  if (f) {
+    if (fread(sim_eeprom, 1, sizeof(sim_eeprom), f) != sizeof(sim_eeprom)) {
+      fprintf(stderr, "%s: short EEPROM image\n", path);
+    }
+    fclose(f);
+  }
+}
+
+static void save_eeprom(const char *path) {
+  FILE *f = fopen(path, "wb");
+  if (f) {
+    fwrite(sim_eeprom, 1, sizeof(sim_eeprom), f);
+    fclose(f);
+  }
+}
+
+static void usage() {
+  fprintf(stderr,
+          "usage: nanolab_sim [options] profile\n"
+          "       nanolab_sim [options] --stream FILE\n"
+          "  -o DIR            card and EEPROM directory (default sim_out)\n"
+          "  --stream FILE     play serial_simulator.py --write output instead\n"
+          "  -q                no actuator trace\n"
+          "  --from MS         reset into the profile at MS, keeping DIR's files\n"
+          "  --until MS        cut power at MS\n"
+          "  --no-sd           run without a card\n"
+          "  --sd-insert MS    run without a card until MS\n"
+          "  --sd-latency W,S  card busy time (us) per sector read or written and per flush\n"
+          "  --sd-dead         a card that answers the probe but fails init\n"
+          "  --adc C,V,T       10-bit current, voltage and temperature readings\n");
+}
+
+int main(int argc, char **argv) {
+  const char *dir = "sim_out";
+  const char *profile = NULL;
+  const char *stream = NULL;
+  uint64_t until = UINT64_MAX;
+  unsigned curr = 300, volt = 900, temp = 250;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+      dir = argv[++i];
+    } else if (!strcmp(argv[i], "--stream") && i + 1 < argc) {
+      stream = argv[++i];
+    } else if (!strcmp(argv[i], "-q")) {
+      quiet = true;
+    } else if (!strcmp(argv[i], "--from") && i + 1 < argc) {
+      profile_start = strtoull(argv[++i], NULL, 10) * 1000;
+    } else if (!strcmp(argv[i], "--until") && i + 1 < argc) {
+      until = strtoull(argv[++i], NULL, 10) * 1000;
+    } else if (!strcmp(argv[i], "--sd-latency") && i + 1 < argc) {
+      if (sscanf(argv[++i], "%u,%u", &sim_sd_write_us, &sim_sd_sync_us) != 2) {
+        usage();
+        return 2;
+      }
+    } else if (!strcmp(argv[i], "--no-sd")) {
+      sim_sd_present = false;
+    } else if (!strcmp(argv[i], "--sd-dead")) {
+      sim_sd_dead = true;
+    } else if (!strcmp(argv[i], "--sd-insert") && i + 1 < argc) {
+      sd_insert = strtoull(argv[++i], NULL, 10) * 1000;
+      sim_sd_present = sd_insert == 0;
+    } else if (!strcmp(argv[i], "--adc") && i + 1 < argc) {
+      if (sscanf(argv[++i], "%u,%u,%u", &curr, &volt, &temp) != 3) {
+        usage();
+        return 2;
+      }
+    } else if (argv[i][0] != '-' && !profile) {
+      profile = argv[i];
+    } else {
+      usage();
+      return 2;
+    }
+  }
+  if (!profile == !stream) {
+    usage();
+    return 2;
+  }
+  if (profile ? !load_profile(profile) : !load_stream(stream)) {
+    return 2;
+  }
+  serialize_packets();
+
+  if (mkdir(dir, 0755) != 0 && errno != EEXIST) {
+    fprintf(stderr, "%s: %s\n", dir, strerror(errno));
+    return 1;
+  }
+  sim_sd_root = dir;
+  std::string eeprom_path = std::string(dir) + "/eeprom.bin";
+  load_eeprom(eeprom_path.c_str());
+
+  // sensor wiring: A3 current, A2 voltage, A1 temperature
+  sim_adc_value[3] = curr;
+  sim_adc_value[2] = volt;
+  sim_adc_value[1] = temp;
+
+  for (size_t i = 0; i < NUM_WIRES; i++) {
+    wire_level[i] = -1;
+  }
+
+  // packets already sent before the reset are gone
+  while (next_packet < packets.size() && packets[next_packet].t < profile_start) {
+    next_packet++;
+  }
+  uint64_t end = packets.empty() ? 0 : packets.back().t + DEFAULT_PACKET_PERIOD * 1000ULL;
+  if (until < end) {
+    end = until;
+  }
+
+  clock_t wall = clock();
+  if (!quiet) {
+    printf("%.6f boot\n", profile_seconds(0));
+  }
+  sim_board = board;
+  setup();
+  sim_service();
+
+  while (sim_now + profile_start < end) {
+    loop();
+    sim_cpu(SIM_CYCLES_LOOP);
+
+    // whether loop() slept or spins until something changes, it
+    // next sees a different world at the next event. the sketch's
+    // own work takes the SIM_CYCLES_* estimates, on top of what its
+    // delays and the card model charge
+    uint64_t next = sim_next_event();
+    sim_now = next > sim_now ? next : sim_now + 1;
+    sim_service();
+  }
+
+  save_eeprom(eeprom_path.c_str());
+  double wall_s = static_cast<double>(clock() - wall) / CLOCKS_PER_SEC;
+  double sim_s = sim_now / 1e6;
+  fprintf(stderr, "simulated %.3f s in %.3f s (%.0fx)\n", sim_s, wall_s, wall_s > 0 ? sim_s / wall_s : 0);
+  return 0;
+}